@@ -0,0 +1,145 @@
+/* arena.c - A bump allocator for short-lived objects
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Depends on
+ * gl_MODULES([xalloc minmax])
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>		/* Gnulib/C89 */
+#include <string.h>		/* Gnulib/C89 */
+#include "xalloc.h"		/* Gnulib */
+#include "minmax.h"		/* Gnulib */
+#include "arena.h"		/* common */
+
+#define ARENA_ALIGN(x)	(((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+typedef struct _ArenaBlock ArenaBlock;
+
+struct _ArenaBlock {
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+};
+
+struct _Arena {
+    ArenaBlock *blocks;		/* most recently added block first */
+    size_t block_size;
+    size_t total_size;		/* size of all blocks */
+};
+
+static ArenaBlock *
+arena_block_new(size_t size)
+{
+    ArenaBlock *block = xmalloc(ARENA_ALIGN(sizeof(ArenaBlock)) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/**
+ * Create a new arena. Memory is allocated from the system in
+ * blocks of at least block_size bytes.
+ */
+Arena *
+arena_new(size_t block_size)
+{
+    Arena *arena = xmalloc(sizeof(Arena));
+    arena->block_size = block_size;
+    arena->blocks = arena_block_new(block_size);
+    arena->total_size = block_size;
+    return arena;
+}
+
+/**
+ * Free the arena and all memory allocated from it.
+ */
+void
+arena_free(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+
+    while (block != NULL) {
+	ArenaBlock *next = block->next;
+	free(block);
+	block = next;
+    }
+    free(arena);
+}
+
+/**
+ * Release all memory allocated from the arena at once. If more
+ * than one block was needed since the last reset, the blocks are
+ * replaced by a single block large enough to hold all of them, so
+ * that the arena settles at the size needed for a typical run.
+ */
+void
+arena_reset(Arena *arena)
+{
+    if (arena->blocks->next != NULL) {
+	ArenaBlock *block = arena->blocks;
+
+	while (block != NULL) {
+	    ArenaBlock *next = block->next;
+	    free(block);
+	    block = next;
+	}
+	arena->blocks = arena_block_new(arena->total_size);
+    }
+    arena->blocks->used = 0;
+}
+
+/**
+ * Allocate size bytes from the arena. The memory is suitably
+ * aligned for any pointer or integer type, and remains valid
+ * until the arena is reset or freed.
+ */
+void *
+arena_alloc(Arena *arena, size_t size)
+{
+    ArenaBlock *block = arena->blocks;
+    void *mem;
+
+    size = ARENA_ALIGN(size);
+    if (block->size - block->used < size) {
+	block = arena_block_new(MAX(size, arena->block_size));
+	block->next = arena->blocks;
+	arena->blocks = block;
+	arena->total_size += block->size;
+    }
+
+    mem = (char *) block + ARENA_ALIGN(sizeof(ArenaBlock)) + block->used;
+    block->used += size;
+    return mem;
+}
+
+/**
+ * Copy len bytes of a string into the arena, and terminate
+ * the copy with a null byte.
+ */
+char *
+arena_strndup(Arena *arena, const char *str, size_t len)
+{
+    char *copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
@@ -37,4 +37,11 @@
 			return a-b; \
 	}
 
+/* For parameters required by the type of a callback but not used */
+#ifdef __GNUC__
+#define UNUSED		__attribute__ ((unused))
+#else
+#define UNUSED
+#endif
+
 #endif
@@ -55,13 +55,15 @@
 #include <sys/stat.h>		/* Gnulib/POSIX */
 #include <stdio.h>		/* C89 */
 #include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
 #include <errno.h>		/* C89 */
 #include "xalloc.h"		/* Gnulib */
 #include "xvasprintf.h"		/* Gnulib */
+#include "minmax.h"		/* Gnulib */
 #include "strbuf.h"		/* common */
 #include "error.h"		/* common */
 #include "string-utils.h"	/* common */
-#include "llist.h"		/* common */
+#include "io-utils.h"		/* common */
 
 /**
  * Return true if the file exists, even if it may be a symbolic
@@ -237,44 +239,195 @@ backticks(const char *program, char *const args[], int *status)
 }
 #endif
 
+typedef struct {
+	DIR *dir;
+	size_t length;		/* length of the path of the directory */
+} DirWalkerLevel;
+
+/* The directories being read, outermost first. Only one stream
+ * per level is open and the names are built in a single buffer,
+ * so directories are never read into memory as a whole. */
+struct _DirWalker {
+	DirWalkerLevel *levels;
+	size_t depth;
+	size_t max_depth;
+	char *path;
+	size_t path_size;
+	bool failed;
+};
+
 /**
- * Read a directory into a glib list. Each list entry should
- * be freed with free and the list with g_list_free.
- * FIXME: provide Iterator directory_iterator(const char *dir)!
+ * Open a directory below the current one, whose name is in the
+ * path buffer. Returns false if it could not be opened.
  */
-LList *
-read_directory(const char *dir)
+static bool
+dir_walker_push(DirWalker *walker, size_t length)
 {
 	DIR *dp;
-	struct dirent *ep;
-	LList *files = llist_new();
 
-	dp = opendir(dir);
+	dp = opendir(walker->path);
 	if (dp == NULL)
-		return NULL;
+		return false;
+	if (walker->depth >= walker->max_depth)
+		walker->levels = x2nrealloc(walker->levels, &walker->max_depth, sizeof(DirWalkerLevel));
+	walker->levels[walker->depth].dir = dp;
+	walker->levels[walker->depth].length = length;
+	walker->depth++;
+	return true;
+}
+
+/**
+ * Start walking the files below a directory. Returns NULL with
+ * errno set if the directory cannot be opened. The walker holds
+ * no global state, so any number of them may be used at once.
+ */
+DirWalker *
+dir_walker_new(const char *root)
+{
+	DirWalker *walker = xmalloc(sizeof(DirWalker));
+	size_t length = strlen(root);
 
-	while ((ep = readdir(dp)) != NULL)
-		llist_add(files, xstrdup(ep->d_name));
+	walker->levels = NULL;
+	walker->depth = 0;
+	walker->max_depth = 0;
+	walker->path_size = MAX(length + 1, 256);
+	walker->path = xmalloc(walker->path_size);
+	walker->failed = false;
+	memcpy(walker->path, root, length + 1);
 
-#if CLOSEDIR_VOID
-    	closedir(dp);
-#else
-	if (closedir(dp) == -1)
+	if (!dir_walker_push(walker, length)) {
+		int saved_errno = errno;
+		dir_walker_free(walker);
+		errno = saved_errno;
 		return NULL;
+	}
+	/* avoid double slashes in the names returned */
+	while (length > 0 && walker->path[length-1] == '/')
+		length--;
+	walker->levels[0].length = length;
+	return walker;
+}
+
+/**
+ * Return the name of the next regular file below the directory,
+ * or NULL when all have been returned. Symbolic links to regular
+ * files are returned too, but links to directories are not
+ * followed. The name is valid until the next call. Directories
+ * that cannot be read are warned about and skipped.
+ */
+const char *
+dir_walker_next(DirWalker *walker)
+{
+	while (walker->depth > 0) {
+		DirWalkerLevel *level = &walker->levels[walker->depth-1];
+		struct dirent *ep;
+		struct stat statbuf;
+		size_t length;
+
+		errno = 0;
+		ep = readdir(level->dir);
+		if (ep == NULL) {
+			if (errno != 0) {
+				walker->path[level->length] = '\0';
+				warn_errno("%s", walker->path);
+				walker->failed = true;
+			}
+			closedir(level->dir);
+			walker->depth--;
+			continue;
+		}
+		if (strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0)
+			continue;
+
+		length = level->length + 1 + NAMLEN(ep);
+		if (length >= walker->path_size) {
+			walker->path_size = MAX(length + 1, walker->path_size * 2);
+			walker->path = xrealloc(walker->path, walker->path_size);
+		}
+		walker->path[level->length] = '/';
+		memcpy(walker->path + level->length + 1, ep->d_name, NAMLEN(ep) + 1);
+
+#ifdef _DIRENT_HAVE_D_TYPE
+		/* most file systems tell the type without a stat */
+		if (ep->d_type == DT_REG)
+			return walker->path;
+		if (ep->d_type == DT_DIR) {
+			statbuf.st_mode = S_IFDIR;
+		} else if (ep->d_type != DT_UNKNOWN && ep->d_type != DT_LNK) {
+			continue;
+		} else
 #endif
+		if (lstat(walker->path, &statbuf) == -1) {
+			warn_errno("%s", walker->path);
+			walker->failed = true;
+			continue;
+		}
+
+		if (S_ISREG(statbuf.st_mode))
+			return walker->path;
+		if (S_ISDIR(statbuf.st_mode)) {
+			if (!dir_walker_push(walker, length)) {
+				warn_errno("%s", walker->path);
+				walker->failed = true;
+			}
+		} else if (S_ISLNK(statbuf.st_mode)) {
+			if (stat(walker->path, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+				return walker->path;
+		}
+	}
+
+	return NULL;
+}
 
-	return files;
+/**
+ * Return true if any directory below the first could not be read.
+ */
+bool
+dir_walker_failed(DirWalker *walker)
+{
+	return walker->failed;
+}
+
+/**
+ * Close the directories still open and free the walker.
+ */
+void
+dir_walker_free(DirWalker *walker)
+{
+	while (walker->depth > 0)
+		closedir(walker->levels[--walker->depth].dir);
+	free(walker->levels);
+	free(walker->path);
+	free(walker);
 }
 
 /**
  * Read and discard some number of bytes from a stream.
+ * Regular files are seeked instead of read, but it is
+ * still an error to skip past the end of the file.
  */
 int
 fskip(FILE *file, uint32_t bytes)
 {
-	for (; bytes > 0; bytes--) {
-		if (fgetc(file) == EOF)
+	struct stat statbuf;
+	off_t pos;
+
+	if (fstat(fileno(file), &statbuf) == 0 && S_ISREG(statbuf.st_mode)
+			&& (pos = ftello(file)) != -1) {
+		if (pos + bytes > statbuf.st_size) {
+			fseeko(file, 0, SEEK_END);
+			return -1;
+		}
+		return fseeko(file, bytes, SEEK_CUR);
+	}
+
+	while (bytes > 0) {
+		char buf[BUFSIZ];
+		size_t len = MIN(bytes, sizeof(buf));
+
+		if (fread(buf, 1, len, file) != len)
 			return -1;
+		bytes -= len;
 	}
 	return 0;
 }
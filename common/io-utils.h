@@ -23,7 +23,8 @@
 #include <sys/stat.h>		/* Gnulib/POSIX */
 #include <stdio.h>		/* Gnulib/C89 */
 #include "common.h"		/* common */
-#include "llist.h"		/* common */
+
+typedef struct _DirWalker DirWalker;
 
 bool file_exists(const char *file);
 #define is_directory(x)		S_ISDIR(stat_mode(x))
@@ -34,7 +35,10 @@ char *create_temporary_file(char *base);
 char *read_line(FILE *in);
 char *backticks(const char *program, char *const args[], int *rc);
 #endif
-LList *read_directory(const char *dir);
+DirWalker *dir_walker_new(const char *root);
+const char *dir_walker_next(DirWalker *walker);
+bool dir_walker_failed(DirWalker *walker);
+void dir_walker_free(DirWalker *walker);
 /* ssize_t xread(int fd, void *buf, size_t count); */
 /* ssize_t xwrite(int fd, const void *buf, size_t count); */
 int fskip(FILE *file, uint32_t bytes);
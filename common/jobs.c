@@ -0,0 +1,243 @@
+/* jobs.c - Running independent jobs in worker processes
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Depends on
+ * gl_MODULES([xalloc])
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <sys/types.h>		/* POSIX */
+#include <errno.h>		/* C89 */
+#include <stdio.h>		/* Gnulib/C89 */
+#include <stdlib.h>		/* Gnulib/C89 */
+#if HAVE_SYS_WAIT_H
+#include <sys/wait.h>		/* POSIX */
+#endif
+#include <unistd.h>		/* POSIX */
+#include "gettext.h"		/* Gnulib */
+#define _(s) gettext(s)
+#include "xalloc.h"		/* Gnulib */
+#include "error.h"		/* common */
+#include "jobs.h"		/* common */
+
+#if HAVE_FORK && HAVE_SYS_WAIT_H
+#define HAVE_WORKER_PROCESSES 1
+#endif
+
+typedef struct _Job Job;
+
+/* A job that has been started but whose output has not been
+ * written yet. */
+struct _Job {
+    pid_t pid;
+    FILE *out;
+    FILE *err;
+    bool done;
+    bool failed;
+};
+
+struct _JobPool {
+    int max_jobs;
+    int running;
+    Job *queue;			/* circular, in the order of submission */
+    int queue_size;
+    int queue_start;
+    int queue_length;
+    bool failed;
+};
+
+#ifdef HAVE_WORKER_PROCESSES
+
+/**
+ * Copy the output saved by a job and close the temporary file.
+ * Returns false if it could not be read back or written.
+ */
+static bool
+copy_output(FILE *in, FILE *out)
+{
+    char buf[BUFSIZ];
+    size_t len;
+    bool success = true;
+
+    rewind(in);
+    while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+	if (fwrite(buf, 1, len, out) != len) {
+	    success = false;
+	    break;
+	}
+    }
+    if (ferror(in))
+	success = false;
+    fclose(in);
+    return success;
+}
+
+/**
+ * Write the output of the oldest jobs that have finished, so that
+ * output appears in the order jobs were submitted.
+ */
+static void
+flush_finished_jobs(JobPool *pool)
+{
+    while (pool->queue_length > 0 && pool->queue[pool->queue_start].done) {
+	Job *job = &pool->queue[pool->queue_start];
+
+	if (!copy_output(job->out, stdout) || fflush(stdout) != 0) {
+	    warn_errno(_("cannot write output of worker process"));
+	    job->failed = true;
+	}
+	if (!copy_output(job->err, stderr))
+	    job->failed = true;
+	if (job->failed)
+	    pool->failed = true;
+	pool->queue_start = (pool->queue_start + 1) % pool->queue_size;
+	pool->queue_length--;
+    }
+}
+
+/**
+ * Wait for any running job to terminate.
+ */
+static void
+wait_for_job(JobPool *pool)
+{
+    int c, status;
+    pid_t pid;
+
+    do {
+	pid = waitpid(-1, &status, 0);
+    } while (pid == -1 && errno == EINTR);
+    if (pid == -1)
+	die_errno(_("cannot wait for worker process"));
+
+    for (c = 0; c < pool->queue_length; c++) {
+	Job *job = &pool->queue[(pool->queue_start + c) % pool->queue_size];
+	if (!job->done && job->pid == pid) {
+	    job->done = true;
+	    job->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	    pool->running--;
+	    break;
+	}
+    }
+    flush_finished_jobs(pool);
+}
+
+#endif
+
+/**
+ * Create a pool running at most max_jobs jobs at a time. With
+ * max_jobs of 1, or if worker processes are not supported on
+ * this system, jobs are run directly when submitted.
+ */
+JobPool *
+job_pool_new(int max_jobs)
+{
+    JobPool *pool = xmalloc(sizeof(JobPool));
+
+#ifdef HAVE_WORKER_PROCESSES
+    pool->max_jobs = max_jobs;
+#else
+    pool->max_jobs = 1;
+#endif
+    pool->running = 0;
+    /* let finished jobs wait for a slow one for a while, but do not
+     * keep an unbounded number of temporary files open */
+    pool->queue_size = pool->max_jobs * 4;
+    pool->queue = xmalloc(sizeof(Job) * pool->queue_size);
+    pool->queue_start = 0;
+    pool->queue_length = 0;
+    pool->failed = false;
+    return pool;
+}
+
+/**
+ * Run fn(data) in a worker process, once there is one available.
+ * Anything the job writes to standard output and standard error
+ * is written by the calling process when the job is done, after
+ * the output of all jobs submitted before it. The job fails if
+ * fn returns non-zero or the process terminates abnormally (for
+ * example by calling die).
+ */
+void
+job_pool_submit(JobPool *pool, job_fn_t fn, void *data)
+{
+#ifdef HAVE_WORKER_PROCESSES
+    Job *job;
+
+    if (pool->max_jobs > 1) {
+	while (pool->running >= pool->max_jobs || pool->queue_length >= pool->queue_size)
+	    wait_for_job(pool);
+
+	job = &pool->queue[(pool->queue_start + pool->queue_length) % pool->queue_size];
+	job->out = tmpfile();
+	job->err = tmpfile();
+	if (job->out == NULL || job->err == NULL)
+	    die_errno(_("cannot create temporary file"));
+	job->done = false;
+	job->failed = false;
+
+	fflush(stdout);
+	fflush(stderr);
+	job->pid = fork();
+	if (job->pid == -1)
+	    die_errno(_("cannot create worker process"));
+	if (job->pid == 0) {
+	    int status;
+
+	    if (dup2(fileno(job->out), STDOUT_FILENO) == -1
+		    || dup2(fileno(job->err), STDERR_FILENO) == -1)
+		_exit(1);
+	    status = fn(data);
+	    /* output that could not be saved fails the job */
+	    if (fflush(stdout) != 0 || fflush(stderr) != 0)
+		status = 1;
+	    _exit(status);
+	}
+
+	pool->running++;
+	pool->queue_length++;
+	return;
+    }
+#endif
+
+    if (fn(data) != 0)
+	pool->failed = true;
+}
+
+/**
+ * Wait for all jobs to finish, write their output, and free the
+ * pool. Returns false if any job failed.
+ */
+bool
+job_pool_finish(JobPool *pool)
+{
+    bool success;
+
+#ifdef HAVE_WORKER_PROCESSES
+    while (pool->running > 0)
+	wait_for_job(pool);
+    flush_finished_jobs(pool);
+#endif
+
+    success = !pool->failed;
+    free(pool->queue);
+    free(pool);
+    return success;
+}
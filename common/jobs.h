@@ -0,0 +1,31 @@
+/* jobs.h - Running independent jobs in worker processes
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_JOBS_H
+#define COMMON_JOBS_H
+
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+
+typedef struct _JobPool JobPool;
+typedef int (*job_fn_t)(void *data);
+
+JobPool *job_pool_new(int max_jobs);
+void job_pool_submit(JobPool *pool, job_fn_t fn, void *data);
+bool job_pool_finish(JobPool *pool);
+
+#endif
@@ -0,0 +1,302 @@
+/* json.c - Writing records of JSON objects
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Depends on
+ * gl_MODULES([xalloc])
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>		/* Gnulib/C89 */
+#include <string.h>		/* Gnulib/C89 */
+#include "xalloc.h"		/* Gnulib */
+#include "json.h"		/* common */
+
+#define JSON_BUFFER_SIZE	(64 * 1024)
+/* the most a character of a string may take, as in \u001f */
+#define JSON_MAX_ESCAPE		6
+
+/* Records are written as one object per line (NDJSON). They are
+ * formatted directly into a large buffer, which is only written
+ * to the stream when full or flushed. */
+struct _JsonWriter {
+    FILE *out;
+    char *buf;
+    size_t len;
+    size_t size;
+    bool first_field;		/* nothing written in the object yet */
+    bool failed;
+};
+
+static void
+json_reserve(JsonWriter *writer, size_t count)
+{
+    if (writer->size - writer->len >= count)
+	return;
+    json_writer_flush(writer);
+    if (writer->size < count) {
+	writer->size = count;
+	writer->buf = xrealloc(writer->buf, writer->size);
+    }
+}
+
+static void
+json_put_data(JsonWriter *writer, const char *data, size_t len)
+{
+    json_reserve(writer, len);
+    memcpy(writer->buf + writer->len, data, len);
+    writer->len += len;
+}
+
+/**
+ * Write the key of a field, which must not need escaping.
+ */
+static void
+json_put_key(JsonWriter *writer, const char *key)
+{
+    size_t len = strlen(key);
+    char *p;
+
+    json_reserve(writer, len + 4);
+    p = writer->buf + writer->len;
+    if (!writer->first_field)
+	*p++ = ',';
+    *p++ = '"';
+    memcpy(p, key, len);
+    p += len;
+    *p++ = '"';
+    *p++ = ':';
+    writer->len = p - writer->buf;
+    writer->first_field = false;
+}
+
+/**
+ * Return the length of the UTF-8 sequence starting with a byte
+ * of 0x80 or more, or 0 if it is not a valid sequence.
+ */
+static size_t
+utf8_sequence_length(const unsigned char *s)
+{
+    uint32_t code, min;
+    size_t len, c;
+
+    if (s[0] < 0xC2 || s[0] > 0xF4)
+	return 0;
+    if (s[0] < 0xE0) {
+	len = 2;
+	code = s[0] & 0x1F;
+	min = 0x80;
+    } else if (s[0] < 0xF0) {
+	len = 3;
+	code = s[0] & 0x0F;
+	min = 0x800;
+    } else {
+	len = 4;
+	code = s[0] & 0x07;
+	min = 0x10000;
+    }
+    /* this also stops at the terminating null byte */
+    for (c = 1; c < len; c++) {
+	if ((s[c] & 0xC0) != 0x80)
+	    return 0;
+	code = (code << 6) | (s[c] & 0x3F);
+    }
+    if (code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+	return 0;
+    return len;
+}
+
+/**
+ * Create a writer of records to a stream. Nothing is written to
+ * the stream until the buffer is full or json_writer_flush is
+ * called.
+ */
+JsonWriter *
+json_writer_new(FILE *out)
+{
+    JsonWriter *writer = xmalloc(sizeof(JsonWriter));
+
+    writer->out = out;
+    writer->size = JSON_BUFFER_SIZE;
+    writer->buf = xmalloc(writer->size);
+    writer->len = 0;
+    writer->first_field = true;
+    writer->failed = false;
+    return writer;
+}
+
+/**
+ * Start a record.
+ */
+void
+json_writer_begin(JsonWriter *writer)
+{
+    json_put_data(writer, "{", 1);
+    writer->first_field = true;
+}
+
+/**
+ * End a record, terminating its line.
+ */
+void
+json_writer_end(JsonWriter *writer)
+{
+    json_put_data(writer, "}\n", 2);
+}
+
+/**
+ * Add a string field to the record, or null if value is NULL.
+ * Valid UTF-8 is written as it is. Other bytes are written as
+ * the code points of the same value, like ISO-8859-1, so that
+ * the output is valid JSON whatever the encoding of file names.
+ */
+void
+json_writer_string(JsonWriter *writer, const char *key, const char *value)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *s;
+
+    if (value == NULL) {
+	json_writer_null(writer, key);
+	return;
+    }
+
+    json_put_key(writer, key);
+    json_put_data(writer, "\"", 1);
+    for (s = (const unsigned char *) value; *s != '\0'; s++) {
+	char *p;
+	size_t len;
+
+	json_reserve(writer, JSON_MAX_ESCAPE);
+	p = writer->buf + writer->len;
+	if (*s >= 0x20 && *s < 0x80 && *s != '"' && *s != '\\') {
+	    *p++ = *s;
+	} else if (*s >= 0x80 && (len = utf8_sequence_length(s)) != 0) {
+	    memcpy(p, s, len);
+	    p += len;
+	    s += len - 1;
+	} else {
+	    *p++ = '\\';
+	    switch (*s) {
+	    case '"':  *p++ = '"'; break;
+	    case '\\': *p++ = '\\'; break;
+	    case '\b': *p++ = 'b'; break;
+	    case '\f': *p++ = 'f'; break;
+	    case '\n': *p++ = 'n'; break;
+	    case '\r': *p++ = 'r'; break;
+	    case '\t': *p++ = 't'; break;
+	    default:
+		*p++ = 'u';
+		*p++ = '0';
+		*p++ = '0';
+		*p++ = hex[*s >> 4];
+		*p++ = hex[*s & 0x0F];
+		break;
+	    }
+	}
+	writer->len = p - writer->buf;
+    }
+    json_put_data(writer, "\"", 1);
+}
+
+/**
+ * Add a field of an unsigned number to the record.
+ */
+void
+json_writer_uint(JsonWriter *writer, const char *key, uintmax_t value)
+{
+    char digits[3 * sizeof(uintmax_t)];
+    char *p = digits + sizeof(digits);
+
+    do {
+	*--p = '0' + value % 10;
+	value /= 10;
+    } while (value != 0);
+    json_put_key(writer, key);
+    json_put_data(writer, p, digits + sizeof(digits) - p);
+}
+
+/**
+ * Add a field of a signed number to the record.
+ */
+void
+json_writer_int(JsonWriter *writer, const char *key, intmax_t value)
+{
+    char digits[3 * sizeof(uintmax_t) + 1];
+    char *p = digits + sizeof(digits);
+    uintmax_t magnitude = (value < 0 ? -(uintmax_t) value : (uintmax_t) value);
+
+    do {
+	*--p = '0' + magnitude % 10;
+	magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0)
+	*--p = '-';
+    json_put_key(writer, key);
+    json_put_data(writer, p, digits + sizeof(digits) - p);
+}
+
+/**
+ * Add a boolean field to the record.
+ */
+void
+json_writer_bool(JsonWriter *writer, const char *key, bool value)
+{
+    json_put_key(writer, key);
+    if (value)
+	json_put_data(writer, "true", 4);
+    else
+	json_put_data(writer, "false", 5);
+}
+
+/**
+ * Add a null field to the record.
+ */
+void
+json_writer_null(JsonWriter *writer, const char *key)
+{
+    json_put_key(writer, key);
+    json_put_data(writer, "null", 4);
+}
+
+/**
+ * Write what is buffered to the stream. The stream itself is not
+ * flushed. Returns false if this or an earlier write failed.
+ */
+bool
+json_writer_flush(JsonWriter *writer)
+{
+    if (writer->len > 0 && fwrite(writer->buf, 1, writer->len, writer->out) != writer->len)
+	writer->failed = true;
+    writer->len = 0;
+    return !writer->failed;
+}
+
+/**
+ * Flush and free the writer. Returns false if any write failed.
+ */
+bool
+json_writer_free(JsonWriter *writer)
+{
+    bool success = json_writer_flush(writer);
+
+    free(writer->buf);
+    free(writer);
+    return success;
+}
@@ -0,0 +1,39 @@
+/* json.h - Writing records of JSON objects
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_JSON_H
+#define COMMON_JSON_H
+
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+#include <stdint.h>	/* Gnulib/C99/POSIX */
+#include <stdio.h>	/* Gnulib/C89 */
+
+typedef struct _JsonWriter JsonWriter;
+
+JsonWriter *json_writer_new(FILE *out);
+void json_writer_begin(JsonWriter *writer);
+void json_writer_end(JsonWriter *writer);
+void json_writer_string(JsonWriter *writer, const char *key, const char *value);
+void json_writer_int(JsonWriter *writer, const char *key, intmax_t value);
+void json_writer_uint(JsonWriter *writer, const char *key, uintmax_t value);
+void json_writer_bool(JsonWriter *writer, const char *key, bool value);
+void json_writer_null(JsonWriter *writer, const char *key);
+bool json_writer_flush(JsonWriter *writer);
+bool json_writer_free(JsonWriter *writer);
+
+#endif
@@ -460,3 +460,34 @@ xdirname(const char *path)
 
 	return substring(path, 0, pos-path);
 }
+
+/**
+ * Split a string into fields separated by a character, modifying
+ * the string. Missing fields at the end are set to NULL, and if
+ * there are more than `max' fields the last one holds the rest of
+ * the string.
+ *
+ * @returns
+ *   Number of fields found.
+ */
+int
+string_split_c(char *str, char sep, char **fields, int max)
+{
+	int count;
+
+	for (count = 0; count < max; count++) {
+		char *end;
+
+		fields[count] = str;
+		if (count == max-1 || (end = strchr(str, sep)) == NULL) {
+			count++;
+			break;
+		}
+		*end = '\0';
+		str = end+1;
+	}
+	for (max--; max >= count; max--)
+		fields[max] = NULL;
+
+	return count;
+}
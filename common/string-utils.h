@@ -52,6 +52,7 @@ int string_strip_leading_c(char *str, char stripchar);
 int string_index_of_char(const char *str, char findchar);
 int string_index_of_any_f(const char *str, int (*function)(int)); */
 int string_index_of_any(const char *str, const char *findchars);
+int string_split_c(char *str, char sep, char **fields, int max);
 
 int word_get_index(const char *str, int pos);
 char *word_get(const char *str, int idx);
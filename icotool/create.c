@@ -37,6 +37,8 @@
 #include <stdio.h>		/* C89 */
 #include <stdbool.h>		/* Gnulib/POSIX */
 #include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <sys/types.h>		/* POSIX */
 #include "gettext.h"		/* Gnulib */
 #include "xalloc.h"		/* Gnulib */
 #include "minmax.h"		/* Gnulib */
@@ -44,11 +46,44 @@
 #define N_(s) gettext_noop(s)
 #include "common/io-utils.h"
 #include "common/error.h"
+#include "common/jobs.h"
 #include "icotool.h"
 #include "win32.h"
 #include "win32-endian.h"
 
 #define ROW_BYTES(bits) ((((bits) + 31) >> 5) << 2)
+#define RAW_COPY_SIZE (64 * 1024)
+
+/* One image of the icon being created. Only the analysis results are
+ * kept between the two passes of create_icon; pixel data lives only
+ * while a single image is being read or written.
+ */
+typedef struct {
+	const char *filename;
+	FILE *in;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_bytep *row_datas;
+	png_bytep row;
+	bool has_alpha;
+	uint32_t bit_count;
+	uint32_t palette_count;
+	uint32_t image_size;
+	uint32_t mask_size;
+	uint32_t dib_size;
+	uint32_t width;
+	uint32_t height;
+	Palette *palette;
+	bool store_raw;
+	FILE *dib;
+} CreateImage;
+
+/* Arguments of create_layer. */
+typedef struct {
+	CreateImage *img;
+	int32_t bit_count;
+	int32_t alpha_threshold;
+} CreateJob;
 
 static void simple_setvec(uint8_t *data, uint32_t ofs, uint8_t size, uint32_t value);
 
@@ -65,192 +100,505 @@ xfread(void *ptr, size_t size, FILE *stream)
 	return true;
 }
 
-bool
-create_icon(int filec, char **filev, int raw_filec, char** raw_filev, CreateNameGen outfile_gen, bool icon_mode, int32_t hotspot_x, int32_t hotspot_y, int32_t alpha_threshold, int32_t bit_count)
+/* close_png:
+ *   Release the libpng structures and pixel rows of an image,
+ *   leaving the input file open.
+ */
+static void
+close_png(CreateImage *img)
+{
+	if (img->png_ptr != NULL)
+		png_destroy_read_struct(&img->png_ptr, &img->info_ptr, NULL);
+	if (img->row_datas != NULL) {
+		free(img->row_datas[0]);
+		free(img->row_datas);
+		img->row_datas = NULL;
+	}
+	free(img->row);
+	img->row = NULL;
+}
+
+/* open_png:
+ *   Start reading the PNG image from the beginning of its file,
+ *   with transformations set up to give 8-bit RGBA rows.
+ */
+static bool
+open_png(CreateImage *img)
+{
+	char header[8];
+
+	if (fseek(img->in, 0, SEEK_SET) != 0) {
+		warn_errno(_("cannot seek in file"));
+		return false;
+	}
+    	if (!xfread(header, 8, img->in))
+		return false;
+    	if (png_sig_cmp(header, 0, 8)) {
+        	warn(_("not a png file"));
+		return false;
+	}
+
+	img->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
+	if (img->png_ptr == NULL) {
+		warn(_("cannot initialize PNG library"));
+		return false;
+	}
+	img->info_ptr = png_create_info_struct(img->png_ptr);
+	if (img->info_ptr == NULL) {
+		warn(_("cannot create PNG info structure - out of memory"));
+		return false;
+	}
+
+	png_init_io(img->png_ptr, img->in);
+	png_set_sig_bytes(img->png_ptr, 8);
+	png_set_strip_16(img->png_ptr);
+	png_set_expand(img->png_ptr);
+	png_set_gray_to_rgb(img->png_ptr);
+	png_set_filler(img->png_ptr, 0xFF, PNG_FILLER_AFTER);
+	png_read_info(img->png_ptr, img->info_ptr);
+	png_set_interlace_handling(img->png_ptr);
+	png_read_update_info(img->png_ptr, img->info_ptr);
+
+	img->width = png_get_image_width(img->png_ptr, img->info_ptr);
+	img->height = png_get_image_height(img->png_ptr, img->info_ptr);
+	img->has_alpha = (png_get_color_type(img->png_ptr, img->info_ptr) & PNG_COLOR_MASK_ALPHA) != 0;
+	return true;
+}
+
+/* start_png_rows:
+ *   Prepare for reading rows with next_png_row. Rows of a non-interlaced
+ *   image are decoded one at a time into a single buffer. An interlaced
+ *   image can only be put together whole, so it is decoded up front.
+ */
+static void
+start_png_rows(CreateImage *img)
+{
+	uint32_t row_bytes = png_get_rowbytes(img->png_ptr, img->info_ptr);
+	uint32_t d;
+
+	if (png_get_interlace_type(img->png_ptr, img->info_ptr) == PNG_INTERLACE_NONE) {
+		img->row = xmalloc(row_bytes);
+		return;
+	}
+	img->row_datas = xmalloc(img->height * sizeof(png_bytep *));
+	img->row_datas[0] = xmalloc(img->height * row_bytes);
+	for (d = 1; d < img->height; d++)
+		img->row_datas[d] = img->row_datas[d-1] + row_bytes;
+	png_read_image(img->png_ptr, img->row_datas);
+}
+
+/* next_png_row:
+ *   Return row Y of the image. Rows must be requested top to bottom.
+ *   Fully transparent pixels are made black.
+ */
+static png_bytep
+next_png_row(CreateImage *img, uint32_t y)
+{
+	png_bytep row;
+	uint32_t x;
+
+	if (img->row_datas != NULL) {
+		row = img->row_datas[y];
+	} else {
+		row = img->row;
+		png_read_row(img->png_ptr, row, NULL);
+	}
+
+	/* Set color of fully transparent pixels to black.
+	    On Windows Mobile, and possibly on regular Windows OSes as well,
+	    it seems that Windows does not completely ignore RGB-values of 
+	    entirely transparent pixels as expected.
+	 */
+	if (img->has_alpha) {
+		for (x = 0; x < img->width; x++) {
+			if (row[4*x+3] == 0)
+			    row[4*x+0] = row[4*x+1] = row[4*x+2] = 0;
+		}
+	}
+	return row;
+}
+
+/* needs_transparency:
+ *   If there are more than two steps of transparency, or if the two
+ *   steps are NOT either entirely off (0) and entirely on (255), then
+ *   we will lose transparency information if bit_count is not 32.
+ *   A single step, whatever its level, fits the AND mask.
+ */
+static bool
+needs_transparency(const uint8_t *transparency, uint16_t transparency_count)
+{
+	return transparency_count > 2
+	    || (transparency_count == 2 && (transparency[0] == 0 || transparency[255] == 0));
+}
+
+/* analyze_png:
+ *   Decode the image once to find out which bit depth and palette it
+ *   needs, and hence how large its DIB will be. No more than a row (or
+ *   for interlaced images, the image itself) is held at a time.
+ */
+static bool
+analyze_png(CreateImage *img, int32_t bit_count)
+{
+	uint8_t transparency[256];
+	uint16_t transparency_count;
+	bool need_transparency;
+	bool count_colors;
+	uint32_t d, x;
+
+	if (!open_png(img))
+		return false;
+	start_png_rows(img);
+	img->palette = palette_new();
+	if (img->palette == NULL)
+		xalloc_die();
+
+	/* Count number of necessary colors in palette and number of transparencies */
+	memset(transparency, 0, 256);
+	transparency_count = 0;
+	count_colors = true;
+	for (d = 0; d < img->height; d++) {
+		png_bytep row = next_png_row(img, d);
+		for (x = 0; x < img->width; x++) {
+			if (count_colors) {
+			    palette_add(img->palette, row[4*x+0], row[4*x+1], row[4*x+2]);
+			    count_colors = !palette_full(img->palette);
+			}
+			if (img->has_alpha && !transparency[row[4*x+3]]) {
+			    transparency[row[4*x+3]] = 1;
+			    transparency_count++;
+			    /* Once transparency forces 24/32 bpp, the number
+			     * of colors no longer matters. */
+			    if (needs_transparency(transparency, transparency_count))
+				count_colors = false;
+			}
+		}
+	}
+	close_png(img);
+
+	need_transparency = needs_transparency(transparency, transparency_count);
+
+	/* Can we keep all colors in a palette? */
+	if (need_transparency) {
+		if (bit_count != -1) {
+		    if (bit_count != 32)
+			warn("decreasing bit depth will discard variable transparency", transparency_count);
+		    /* Why 24 and not bit_count? Otherwise we might decrease below what's possible
+			   * due to number of colors in image. The real decrease happens below. */
+		    img->bit_count = 24;
+		} else {
+		    img->bit_count = 32;
+		}
+		img->palette_count = 0;
+	}
+	else if (palette_count(img->palette) <= 256) {
+		for (d = 1; palette_count(img->palette) > 1 << d; d <<= 1);
+		if (d == 2)	/* four colors (two bits) are not supported */
+			d = 4;
+		img->bit_count = d;
+		img->palette_count = 1 << d;
+	}
+	else {
+		img->bit_count = 24;
+		img->palette_count = 0;
+	}
+
+	/* Does the user want to change number of bits per pixel? */
+	if (bit_count != -1) {
+		if (img->bit_count == bit_count) {
+			/* No operation */
+		} else if (img->bit_count < bit_count) {
+			img->bit_count = bit_count;
+			img->palette_count = (bit_count > 16 ? 0 : 1 << bit_count);
+		} else {
+			warn(_("cannot decrease bit depth from %d to %d, bit depth not changed"), img->bit_count, bit_count);
+		}
+	}
+
+	img->image_size = img->height * ROW_BYTES(img->width * img->bit_count);
+	img->mask_size = img->height * ROW_BYTES(img->width);
+	img->dib_size = img->palette_count * sizeof(Win32RGBQuad)
+			+ sizeof(Win32BitmapInfoHeader)
+			+ img->image_size
+			+ img->mask_size;
+	return true;
+}
+
+/* analyze_raw:
+ *   Determine the size and bit depth of a PNG image that is to be
+ *   stored as is.
+ */
+static bool
+analyze_raw(CreateImage *img)
+{
+	png_byte ct;
+	off_t size;
+
+	if (!open_png(img))
+		return false;
+	ct = png_get_color_type(img->png_ptr, img->info_ptr);
+	if (ct & PNG_COLOR_MASK_PALETTE)
+	{
+		img->bit_count = png_get_bit_depth(img->png_ptr, img->info_ptr);
+	}
+	else
+		img->bit_count = png_get_bit_depth(img->png_ptr, img->info_ptr)
+			* png_get_channels(img->png_ptr, img->info_ptr);
+	close_png(img);
+
+	if (fseeko(img->in, 0, SEEK_END) != 0 || (size = ftello(img->in)) < 0) {
+		warn_errno(_("cannot seek in file"));
+		return false;
+	}
+	img->image_size = size;
+	img->dib_size = size;
+	return true;
+}
+
+/* copy_data:
+ *   Copy the first SIZE bytes of a file to the output. This is used
+ *   for images that are stored as is, and for images written by
+ *   create_layer.
+ */
+static bool
+copy_data(FILE *in, uint32_t size, FILE *out)
 {
-	struct {
-		FILE *in;
-		png_structp png_ptr;
-		png_infop info_ptr;
-		uint32_t bit_count;
-		uint32_t palette_count;
-		uint32_t image_size;
-		uint32_t mask_size;
-		uint32_t width;
-		uint32_t height;
-		uint8_t *image_data;
-		uint8_t **row_datas;
-		Palette *palette;
-		bool store_raw;
-	} *img;
+	uint8_t *buf;
+	uint32_t pos;
+
+	if (fseek(in, 0, SEEK_SET) != 0) {
+		warn_errno(_("cannot seek in file"));
+		return false;
+	}
+	buf = xmalloc(MIN(size, RAW_COPY_SIZE) + 1);
+	for (pos = 0; pos < size; ) {
+		uint32_t len = MIN(size - pos, RAW_COPY_SIZE);
+		if (!xfread(buf, len, in)) {
+			free(buf);
+			return false;
+		}
+		if (fwrite(buf, len, 1, out) != 1) {
+			free(buf);
+			warn_errno(_("cannot write to file"));
+			return false;
+		}
+		pos += len;
+	}
+	free(buf);
+	return true;
+}
 
+/* write_dib:
+ *   Decode the image a second time, converting each row as it is read,
+ *   and write it as a DIB. Since DIB rows are stored bottom-up, the
+ *   converted pixels and mask of this one image are collected before
+ *   being written.
+ */
+static bool
+write_dib(CreateImage *img, FILE *out, int32_t alpha_threshold)
+{
+	Win32BitmapInfoHeader bitmap;
+	DIBRowEncoder encode_row;
+	uint8_t *image_data = NULL;
+	uint8_t *mask_data = NULL;
+	uint32_t image_row_size;
+	uint32_t mask_row_size;
+	uint32_t d, x;
+	bool success = false;
+
+	bitmap.size = sizeof(Win32BitmapInfoHeader);
+	bitmap.width = img->width;
+	bitmap.height = img->height * 2;
+	bitmap.planes = 1;							// appears to be 1 always (XXX)
+	bitmap.bit_count = img->bit_count;
+	bitmap.compression = 0;
+	bitmap.x_pels_per_meter = 0;				// should be 0 always
+	bitmap.y_pels_per_meter = 0;				// should be 0 always
+	bitmap.clr_important = 0;					// should be 0 always
+	bitmap.clr_used = img->palette_count;
+	bitmap.size_image = img->image_size;		// appears to be ok here (may be image_size+mask_size or 0, XXX)
+
+	fix_win32_bitmap_info_header_endian(&bitmap);
+	if (fwrite(&bitmap, sizeof(Win32BitmapInfoHeader), 1, out) != 1) {
+		warn_errno("cannot write to file");
+		return false;
+	}
+
+	if (img->bit_count <= 16) {
+		Win32RGBQuad color;
+
+		color.reserved = 0;
+		while (palette_next(img->palette, &color.red, &color.green, &color.blue))
+			fwrite(&color, sizeof(Win32RGBQuad), 1, out);
+
+		/* Pad with empty colors. The reason we do this is because we
+		 * specify bitmap.clr_used as a base of 2. The latter is probably
+		 * not necessary according to the original specs, but many
+		 * programs that read icons assume it. Especially gdk-pixbuf.
+		 */
+	    	memset(&color, 0, sizeof(Win32RGBQuad));
+		for (d = palette_count(img->palette); d < 1 << img->bit_count; d++)
+			fwrite(&color, sizeof(Win32RGBQuad), 1, out);
+	}
+
+	if (!open_png(img))
+		return false;
+	start_png_rows(img);
+
+	image_data = xzalloc(img->image_size);
+	mask_data = xzalloc(img->mask_size);
+	image_row_size = img->image_size / img->height;
+	mask_row_size = img->mask_size / img->height;
+	encode_row = dib_row_encoder(img->bit_count);
+
+	for (d = 0; d < img->height; d++) {
+		png_bytep row = next_png_row(img, d);
+		uint32_t y = img->height - d - 1;
+
+		if (img->bit_count < 24) {
+			uint32_t imod = y * image_row_size * 8 / img->bit_count;
+			for (x = 0; x < img->width; x++) {
+				uint32_t color;
+				color = palette_lookup(img->palette, row[4*x+0], row[4*x+1], row[4*x+2]);
+				simple_setvec(image_data, x+imod, img->bit_count, color);
+			}
+		} else if (img->bit_count == 24 || img->bit_count == 32) {
+			encode_row(row, image_data + y * image_row_size, img->width);
+		}
+		dib_encode_mask_row(row, mask_data + y * mask_row_size, img->width, MIN(alpha_threshold, 255));
+	}
+
+	png_read_end(img->png_ptr, img->info_ptr);
+	close_png(img);
+
+	if (fwrite(image_data, img->image_size, 1, out) != 1
+	    || fwrite(mask_data, img->mask_size, 1, out) != 1) {
+		warn_errno(_("cannot write to file"));
+		goto cleanup;
+	}
+	success = true;
+
+cleanup:
+	free(image_data);
+	free(mask_data);
+	return success;
+}
+
+/* create_layer:
+ *   Analyze an image and write its DIB to a temporary file, so that
+ *   this can be done by a worker process. Returns non-zero on failure.
+ */
+static int
+create_layer(void *data)
+{
+	CreateJob *job = data;
+	bool success;
+
+	set_message_header(job->img->filename);
+	success = analyze_png(job->img, job->bit_count)
+	    && write_dib(job->img, job->img->dib, job->alpha_threshold);
+	if (fflush(job->img->dib) != 0) {
+		warn_errno(_("cannot write to file"));
+		success = false;
+	}
+	restore_message_header();
+	return (success ? 0 : 1);
+}
+
+/* read_layer_info:
+ *   Get the size, dimensions and bit depth of an image written by
+ *   create_layer from its bitmap header.
+ */
+static bool
+read_layer_info(CreateImage *img)
+{
+	Win32BitmapInfoHeader bitmap;
+	off_t size;
+
+	if (fseeko(img->dib, 0, SEEK_END) != 0 || (size = ftello(img->dib)) < 0
+	    || fseeko(img->dib, 0, SEEK_SET) != 0) {
+		warn_errno(_("cannot seek in file"));
+		return false;
+	}
+	if (!xfread(&bitmap, sizeof(Win32BitmapInfoHeader), img->dib))
+		return false;
+	fix_win32_bitmap_info_header_endian(&bitmap);
+
+	img->width = bitmap.width;
+	img->height = bitmap.height / 2;
+	img->bit_count = bitmap.bit_count;
+	img->dib_size = size;
+	return true;
+}
+
+/* create_icon:
+ *   Create an icon or cursor file from a number of PNG images. This is
+ *   done in two passes: the first decodes each image to determine its
+ *   bit depth and size for the directory, the second decodes it again
+ *   and writes it. Only one image is ever held in memory.
+ *
+ *   With jobs greater than one, worker processes do both passes for
+ *   an image at a time, writing each DIB to a temporary file that is
+ *   copied to the output once the directory is known.
+ */
+bool
+create_icon(int filec, char **filev, int raw_filec, char** raw_filev, CreateNameGen outfile_gen, bool icon_mode, int32_t hotspot_x, int32_t hotspot_y, int32_t alpha_threshold, int32_t bit_count, int jobs)
+{
+	JobPool *pool = NULL;
+	CreateImage *img;
 	Win32CursorIconFileDir dir;
 	FILE *out;
 	char *outname = NULL;
-	uint32_t c, d, x;
+	uint32_t c;
 	uint32_t dib_start;
-	png_byte ct;
 	int org_filec = filec;
 	
 	filec += raw_filec;
 
 	img = xzalloc(filec * sizeof(*img));
+	if (jobs > 1)
+		pool = job_pool_new(jobs);
 
 	for (c = 0; c < filec; c++) {
-		char header[8];
-		uint32_t row_bytes;
-		uint8_t transparency[256];
-		uint16_t transparency_count;
-		bool need_transparency;
-		const char* real_filev = (c >= org_filec) ? raw_filev[c-org_filec] : filev[c];
-
+		img[c].filename = (c >= org_filec) ? raw_filev[c-org_filec] : filev[c];
 		img[c].store_raw = (c >= org_filec);
-		set_message_header(real_filev);
+		set_message_header(img[c].filename);
 
-		img[c].in = fopen(real_filev, "rb");
+		img[c].in = fopen(img[c].filename, "rb");
     	if (img[c].in == NULL) {
         	warn_errno(_("cannot open file"));
 			goto cleanup;
 		}
-    	if (!xfread(header, 8, img[c].in))
-			goto cleanup;
-    	if (png_sig_cmp(header, 0, 8)) {
-	    
-        	warn(_("not a png file"));
-			goto cleanup;
-		}
-
-		img[c].png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
-		if (img[c].png_ptr == NULL) {
-			warn(_("cannot initialize PNG library"));
-			goto cleanup;
-		}
-		img[c].info_ptr = png_create_info_struct(img[c].png_ptr);
-		if (img[c].info_ptr == NULL) {
-			warn(_("cannot create PNG info structure - out of memory"));
-			goto cleanup;
-		}
-
-		png_init_io(img[c].png_ptr, img[c].in);
-		png_set_sig_bytes(img[c].png_ptr, 8);
-		png_set_strip_16(img[c].png_ptr);
-		png_set_expand(img[c].png_ptr);
-		png_set_gray_to_rgb(img[c].png_ptr);
-		png_set_interlace_handling(img[c].png_ptr);
-		png_set_filler(img[c].png_ptr, 0xFF, PNG_FILLER_AFTER);
-		png_read_info(img[c].png_ptr, img[c].info_ptr);
-		png_read_update_info(img[c].png_ptr, img[c].info_ptr);
-
-		img[c].width = png_get_image_width(img[c].png_ptr, img[c].info_ptr);
-		img[c].height = png_get_image_height(img[c].png_ptr, img[c].info_ptr);
-		
-		if (img[c].store_raw)
-		{
-			ct = png_get_color_type(img[c].png_ptr, img[c].info_ptr);
-			if (ct & PNG_COLOR_MASK_PALETTE)
-			{
-				img[c].bit_count = png_get_bit_depth(img[c].png_ptr, img[c].info_ptr);
-			}
-			else
-				img[c].bit_count = png_get_bit_depth(img[c].png_ptr, img[c].info_ptr)
-					* png_get_channels(img[c].png_ptr, img[c].info_ptr);
-			png_destroy_read_struct(&img[c].png_ptr, &img[c].info_ptr, NULL);
-			
-			fseek(img[c].in, 0, SEEK_END);
-			img[c].image_size = ftell(img[c].in);
-			fseek(img[c].in, 0, SEEK_SET);
-			img[c].image_data = xmalloc(img[c].image_size);
-		    	if (!xfread(img[c].image_data, img[c].image_size, img[c].in))
+		if (img[c].store_raw) {
+			if (!analyze_raw(&img[c]))
 				goto cleanup;
-		}
-		else
-		{
-			row_bytes = png_get_rowbytes(img[c].png_ptr, img[c].info_ptr);
-			img[c].row_datas = xmalloc(img[c].height * sizeof(png_bytep *));
-			img[c].row_datas[0] = xmalloc(img[c].height * row_bytes);
-			for (d = 1; d < img[c].height; d++)
-				img[c].row_datas[d] = img[c].row_datas[d-1] + row_bytes;
-			png_read_rows(img[c].png_ptr, img[c].row_datas, NULL, img[c].height);
-
-			ct = png_get_color_type(img[c].png_ptr, img[c].info_ptr);
-			img[c].palette = palette_new();
-
-
-			/* Count number of necessary colors in palette and number of transparencies */
-			memset(transparency, 0, 256);
-			for (d = 0; d < img[c].height; d++) {
-				png_bytep row = img[c].row_datas[d];
-				for (x = 0; x < img[c].width; x++) {
-					/* Set color of fully transparent pixels to black.
-					    On Windows Mobile, and possibly on regular Windows OSes as well,
-					    it seems that Windows does not completely ignore RGB-values of 
-					    entirely transparent pixels as expected.
-					 */
-					if ((ct & PNG_COLOR_MASK_ALPHA) && (row[4*x+3] == 0))
-					    row[4*x+0] = row[4*x+1] = row[4*x+2] = 0;
-					if (palette_count(img[c].palette) <= (1 << 8))
-					    palette_add(img[c].palette, row[4*x+0], row[4*x+1], row[4*x+2]);
-					if (ct & PNG_COLOR_MASK_ALPHA)
-					    transparency[row[4*x+3]] = 1;
-				}
-			}
-			transparency_count = 0;
-			for (d = 0; d < 256; d++)
-			    transparency_count += transparency[d];
-
-			/* If there are more than two steps of transparency, or if the
-			 * two steps are NOT either entirely off (0) and entirely on (255),
-			 * then we will lose transparency information if bit_count is not 32.
-			 */
-			need_transparency =
-			    transparency_count > 2
-			    ||
-			    (transparency_count == 2 && (transparency[0] == 0 || transparency[255] == 0));
-
-			/* Can we keep all colors in a palette? */
-			if (need_transparency) {
-				if (bit_count != -1) {
-				    if (bit_count != 32)
-					warn("decreasing bit depth will discard variable transparency", transparency_count);
-				    /* Why 24 and not bit_count? Otherwise we might decrease below what's possible
-					   * due to number of colors in image. The real decrease happens below. */
-				    img[c].bit_count = 24;
-				} else {
-				    img[c].bit_count = 32;
-				}
-				img[c].palette_count = 0;
-			}
-			else if (palette_count(img[c].palette) <= 256) {
-				for (d = 1; palette_count(img[c].palette) > 1 << d; d <<= 1);
-				if (d == 2)	/* four colors (two bits) are not supported */
-					d = 4;
-				img[c].bit_count = d;
-				img[c].palette_count = 1 << d;
-			}
-			else {
-				img[c].bit_count = 24;
-				img[c].palette_count = 0;
-			}
+		} else if (pool != NULL) {
+			CreateJob job = { &img[c], bit_count, alpha_threshold };
 
-			/* Does the user want to change number of bits per pixel? */
-			if (bit_count != -1) {
-				if (img[c].bit_count == bit_count) {
-					/* No operation */
-				} else if (img[c].bit_count < bit_count) {
-					img[c].bit_count = bit_count;
-					img[c].palette_count = (bit_count > 16 ? 0 : 1 << bit_count);
-				} else {
-					warn(_("cannot decrease bit depth from %d to %d, bit depth not changed"), img[c].bit_count, bit_count);
-				}
+			img[c].dib = tmpfile();
+			if (img[c].dib == NULL) {
+				warn_errno(_("cannot create temporary file"));
+				goto cleanup;
 			}
-		
-			img[c].image_size = img[c].height * ROW_BYTES(img[c].width * img[c].bit_count);
-			img[c].mask_size = img[c].height * ROW_BYTES(img[c].width);
+			job_pool_submit(pool, create_layer, &job);
+		} else if (!analyze_png(&img[c], bit_count)) {
+			goto cleanup;
 		}
 
 		restore_message_header();
 	}
 
+	if (pool != NULL) {
+		bool success = job_pool_finish(pool);
+
+		pool = NULL;
+		if (!success)
+			goto cleanup;
+		for (c = 0; c < filec; c++) {
+			if (img[c].dib != NULL && !read_layer_info(&img[c]))
+				goto cleanup;
+		}
+	}
+
 	out = outfile_gen(&outname);
 	restore_message_header();
 	set_message_header(outname);
@@ -294,13 +642,7 @@ create_icon(int filec, char **filev, int raw_filec, char** raw_filev, CreateName
 		}
 		entry.dib_offset = dib_start;
 		entry.color_count = (img[c].bit_count >= 8 ? 0 : 1 << img[c].bit_count);
-		if (img[c].store_raw)
-			entry.dib_size = img[c].image_size;
-		else
-			entry.dib_size = img[c].palette_count * sizeof(Win32RGBQuad)
-					+ sizeof(Win32BitmapInfoHeader)
-					+ img[c].image_size
-					+ img[c].mask_size;
+		entry.dib_size = img[c].dib_size;
 
 		dib_start += entry.dib_size;
 
@@ -313,119 +655,18 @@ create_icon(int filec, char **filev, int raw_filec, char** raw_filev, CreateName
 	}
 
 	for (c = 0; c < filec; c++) {
-		if (img[c].store_raw)
-		{
-			if (fwrite(img[c].image_data, img[c].image_size, 1, out) != 1) {
-				warn_errno(_("cannot write to file"));
+		if (img[c].dib != NULL) {
+			if (!copy_data(img[c].dib, img[c].dib_size, out))
 				goto cleanup;
-			}
-		}
-		else
-		{
-			Win32BitmapInfoHeader bitmap;
-
-			bitmap.size = sizeof(Win32BitmapInfoHeader);
-			bitmap.width = png_get_image_width(img[c].png_ptr, img[c].info_ptr);
-			bitmap.height = png_get_image_height(img[c].png_ptr, img[c].info_ptr) * 2;
-			bitmap.planes = 1;							// appears to be 1 always (XXX)
-			bitmap.bit_count = img[c].bit_count;
-			bitmap.compression = 0;
-			bitmap.x_pels_per_meter = 0;				// should be 0 always
-			bitmap.y_pels_per_meter = 0;				// should be 0 always
-			bitmap.clr_important = 0;					// should be 0 always
-			bitmap.clr_used = img[c].palette_count;
-			bitmap.size_image = img[c].image_size;		// appears to be ok here (may be image_size+mask_size or 0, XXX)
-
-			fix_win32_bitmap_info_header_endian(&bitmap);
-			if (fwrite(&bitmap, sizeof(Win32BitmapInfoHeader), 1, out) != 1) {
-				warn_errno("cannot write to file");
+		} else if (img[c].store_raw) {
+			if (!copy_data(img[c].in, img[c].image_size, out))
 				goto cleanup;
-			}
-
-			if (img[c].bit_count <= 16) {
-				Win32RGBQuad color;
-
-				palette_assign_indices(img[c].palette);
-				color.reserved = 0;
-				while (palette_next(img[c].palette, &color.red, &color.green, &color.blue))
-					fwrite(&color, sizeof(Win32RGBQuad), 1, out);
-
-				/* Pad with empty colors. The reason we do this is because we
-				 * specify bitmap.clr_used as a base of 2. The latter is probably
-				 * not necessary according to the original specs, but many
-				 * programs that read icons assume it. Especially gdk-pixbuf.
-				 */
-			    	memset(&color, 0, sizeof(Win32RGBQuad));
-				for (d = palette_count(img[c].palette); d < 1 << img[c].bit_count; d++)
-					fwrite(&color, sizeof(Win32RGBQuad), 1, out);
-			}
-
-			img[c].image_data = xzalloc(img[c].image_size);
-
-			for (d = 0; d < img[c].height; d++) {
-				png_bytep row = img[c].row_datas[img[c].height - d - 1];
-				if (img[c].bit_count < 24) {
-					uint32_t imod = d * (img[c].image_size/img[c].height) * 8 / img[c].bit_count;
-					for (x = 0; x < img[c].width; x++) {
-						uint32_t color;
-						color = palette_lookup(img[c].palette, row[4*x+0], row[4*x+1], row[4*x+2]);
-						simple_setvec(img[c].image_data, x+imod, img[c].bit_count, color);
-					}
-				} else if (img[c].bit_count == 24) {
-					uint32_t irow = d * (img[c].image_size/img[c].height);
-					for (x = 0; x < img[c].width; x++) {
-						img[c].image_data[3*x+0 + irow] = row[4*x+2];
-						img[c].image_data[3*x+1 + irow] = row[4*x+1];
-						img[c].image_data[3*x+2 + irow] = row[4*x+0];
-					}
-				} else if (img[c].bit_count == 32) {
-					uint32_t irow = d * (img[c].image_size/img[c].height);
-					for (x = 0; x < img[c].width; x++) {
-						img[c].image_data[4*x+0 + irow] = row[4*x+2];
-						img[c].image_data[4*x+1 + irow] = row[4*x+1];
-						img[c].image_data[4*x+2 + irow] = row[4*x+0];
-						img[c].image_data[4*x+3 + irow] = row[4*x+3];
-					}
-				}
-			}
-
-			if (fwrite(img[c].image_data, img[c].image_size, 1, out) != 1) {
-				warn_errno(_("cannot write to file"));
-				goto cleanup;
-			}
-
-			for (d = 0; d < img[c].height; d++) {
-				png_bytep row = img[c].row_datas[img[c].height - d - 1];
-
-				for (x = 0; x < img[c].width; x += 8) {
-					uint8_t mask = 0;
-					mask |= (row[4*(x+0)+3] <= alpha_threshold ? 1 << 7 : 0);
-					mask |= (row[4*(x+1)+3] <= alpha_threshold ? 1 << 6 : 0);
-					mask |= (row[4*(x+2)+3] <= alpha_threshold ? 1 << 5 : 0);
-					mask |= (row[4*(x+3)+3] <= alpha_threshold ? 1 << 4 : 0);
-					mask |= (row[4*(x+4)+3] <= alpha_threshold ? 1 << 3 : 0);
-					mask |= (row[4*(x+5)+3] <= alpha_threshold ? 1 << 2 : 0);
-					mask |= (row[4*(x+6)+3] <= alpha_threshold ? 1 << 1 : 0);
-					mask |= (row[4*(x+7)+3] <= alpha_threshold ? 1 << 0 : 0);
-					fputc(mask, out);
-				}
-
-				fpad(out, 0, img[c].mask_size/img[c].height - x/8);
-			}
+		} else if (!write_dib(&img[c], out, alpha_threshold)) {
+			goto cleanup;
 		}
 
-		free(img[c].image_data);
 		if (img[c].palette) palette_free(img[c].palette);
-		if (img[c].row_datas)
-		{
-			free(img[c].row_datas[0]);
-			free(img[c].row_datas);
-		}
-		if (!img[c].store_raw)
-		{
-			png_read_end(img[c].png_ptr, img[c].info_ptr);
-		}
-		png_destroy_read_struct(&img[c].png_ptr, &img[c].info_ptr, NULL);
+		if (img[c].dib) fclose(img[c].dib);
 		fclose(img[c].in);
 		memset(&img[c], 0, sizeof(*img));
 	}
@@ -437,17 +678,14 @@ create_icon(int filec, char **filev, int raw_filec, char** raw_filev, CreateName
 cleanup:
 
 	restore_message_header();
+	if (pool != NULL)
+		job_pool_finish(pool);
 	for (c = 0; c < filec; c++) {
-		if (img[c].image_data != NULL)
-			free(img[c].image_data);
+		close_png(&img[c]);
 		if (img[c].palette != NULL)
 			palette_free(img[c].palette);
-		if (img[c].row_datas != NULL && img[c].row_datas[0] != NULL) {
-			free(img[c].row_datas[0]);
-			free(img[c].row_datas);
-		}
-		if (img[c].png_ptr != NULL)
-			png_destroy_read_struct(&img[c].png_ptr, &img[c].info_ptr, NULL);
+		if (img[c].dib != NULL)
+			fclose(img[c].dib);
 		if (img[c].in != NULL)
 			fclose(img[c].in);
 	}
@@ -0,0 +1,333 @@
+/* dib-x86.c - Conversion of bitmap rows using x86 vector instructions
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>		/* Gnulib/POSIX */
+#include <string.h>		/* C89 */
+#include "icotool.h"
+
+#if HAVE_X86_DIB_KERNELS
+
+#include <immintrin.h>		/* GCC */
+
+/* The functions here are compiled for the instruction set named in
+ * their target attribute, and must only be called if the processor
+ * supports it. Each function converts as many pixels as possible with
+ * vector instructions, and the rest the same way as dib.c. Loads and
+ * stores never go past the pixels of the row. */
+
+#define SSE2	__attribute__ ((target ("sse2")))
+#define SSSE3	__attribute__ ((target ("ssse3")))
+#define AVX2	__attribute__ ((target ("avx2")))
+
+/* bits 0-3 reversed, for turning movemask results into mask bytes */
+static const uint8_t reverse_nibble[16] = {
+	0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+	0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+};
+
+static void
+swap_red_blue(const uint8_t *src, uint8_t *dst, uint32_t x, uint32_t width)
+{
+	for (; x < width; x++) {
+		dst[4*x+0] = src[4*x+2];
+		dst[4*x+1] = src[4*x+1];
+		dst[4*x+2] = src[4*x+0];
+		dst[4*x+3] = src[4*x+3];
+	}
+}
+
+static SSSE3 void
+swap_red_blue_ssse3(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	const __m128i shuffle = _mm_setr_epi8(2,1,0,3, 6,5,4,7, 10,9,8,11, 14,13,12,15);
+	uint32_t x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *) (src + 4*x));
+		_mm_storeu_si128((__m128i *) (dst + 4*x), _mm_shuffle_epi8(p, shuffle));
+	}
+	swap_red_blue(src, dst, x, width);
+}
+
+static AVX2 void
+swap_red_blue_avx2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	const __m256i shuffle = _mm256_setr_epi8(
+		2,1,0,3, 6,5,4,7, 10,9,8,11, 14,13,12,15,
+		2,1,0,3, 6,5,4,7, 10,9,8,11, 14,13,12,15);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i p = _mm256_loadu_si256((const __m256i *) (src + 4*x));
+		_mm256_storeu_si256((__m256i *) (dst + 4*x), _mm256_shuffle_epi8(p, shuffle));
+	}
+	swap_red_blue(src, dst, x, width);
+}
+
+static SSSE3 bool
+decode_row_32_ssse3(const uint8_t *src, uint8_t *dst, uint32_t width, UNUSED const uint32_t *palette, UNUSED uint32_t palette_count)
+{
+	swap_red_blue_ssse3(src, dst, width);
+	return true;
+}
+
+static AVX2 bool
+decode_row_32_avx2(const uint8_t *src, uint8_t *dst, uint32_t width, UNUSED const uint32_t *palette, UNUSED uint32_t palette_count)
+{
+	swap_red_blue_avx2(src, dst, width);
+	return true;
+}
+
+static SSSE3 void
+encode_row_32_ssse3(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	swap_red_blue_ssse3(src, dst, width);
+}
+
+static AVX2 void
+encode_row_32_avx2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	swap_red_blue_avx2(src, dst, width);
+}
+
+/* Four pixels (twelve bytes) are converted at a time, but sixteen
+ * bytes are loaded or stored, so the last few pixels of the row are
+ * always done one by one. */
+static SSSE3 bool
+decode_row_24_ssse3(const uint8_t *src, uint8_t *dst, uint32_t width, UNUSED const uint32_t *palette, UNUSED uint32_t palette_count)
+{
+	const __m128i shuffle = _mm_setr_epi8(2,1,0,-1, 5,4,3,-1, 8,7,6,-1, 11,10,9,-1);
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+	uint32_t x;
+
+	for (x = 0; x + 6 <= width; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *) (src + 3*x));
+		p = _mm_or_si128(_mm_shuffle_epi8(p, shuffle), alpha);
+		_mm_storeu_si128((__m128i *) (dst + 4*x), p);
+	}
+	for (; x < width; x++) {
+		dst[4*x+0] = src[3*x+2];
+		dst[4*x+1] = src[3*x+1];
+		dst[4*x+2] = src[3*x+0];
+		dst[4*x+3] = 0xFF;
+	}
+	return true;
+}
+
+static SSSE3 void
+encode_row_24_ssse3(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	const __m128i shuffle = _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1);
+	uint32_t x;
+
+	for (x = 0; x + 6 <= width; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *) (src + 4*x));
+		_mm_storeu_si128((__m128i *) (dst + 3*x), _mm_shuffle_epi8(p, shuffle));
+	}
+	for (; x < width; x++) {
+		dst[3*x+0] = src[4*x+2];
+		dst[3*x+1] = src[4*x+1];
+		dst[3*x+2] = src[4*x+0];
+	}
+}
+
+/* Palettized rows are decoded by gathering eight colors at a time.
+ * The largest index seen is compared with the palette size once,
+ * after the whole row has been converted. */
+static AVX2 bool
+decode_row_8_avx2(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	__m256i max_index = _mm256_setzero_si256();
+	uint32_t x, bad = 0;
+	uint32_t max[8];
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + x)));
+		__m256i p = _mm256_i32gather_epi32((const int *) palette, index, 4);
+		max_index = _mm256_max_epu32(max_index, index);
+		_mm256_storeu_si256((__m256i *) (dst + 4*x), p);
+	}
+	_mm256_storeu_si256((__m256i *) max, max_index);
+	for (; x < width; x++) {
+		uint32_t index = src[x];
+		bad |= (index >= palette_count);
+		memcpy(dst + 4*x, &palette[index], 4);
+	}
+	for (x = 0; x < 8 && width >= 8; x++)
+		bad |= (max[x] >= palette_count);
+	return !bad;
+}
+
+static AVX2 bool
+decode_row_4_avx2(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	const __m128i spread = _mm_setr_epi8(0,0, 1,1, 2,2, 3,3, -1,-1,-1,-1, -1,-1,-1,-1);
+	const __m256i shift = _mm256_setr_epi32(4,0, 4,0, 4,0, 4,0);
+	const __m256i nibble = _mm256_set1_epi32(15);
+	__m256i max_index = _mm256_setzero_si256();
+	uint32_t x, bad = 0;
+	uint32_t max[8];
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i index, p;
+		int32_t packed;
+
+		memcpy(&packed, src + x/2, 4);
+		index = _mm256_cvtepu8_epi32(_mm_shuffle_epi8(_mm_cvtsi32_si128(packed), spread));
+		index = _mm256_and_si256(_mm256_srlv_epi32(index, shift), nibble);
+		p = _mm256_i32gather_epi32((const int *) palette, index, 4);
+		max_index = _mm256_max_epu32(max_index, index);
+		_mm256_storeu_si256((__m256i *) (dst + 4*x), p);
+	}
+	_mm256_storeu_si256((__m256i *) max, max_index);
+	for (; x < width; x++) {
+		uint32_t index = (src[x >> 1] >> ((1 - (x & 1)) << 2)) & 15;
+		bad |= (index >= palette_count);
+		memcpy(dst + 4*x, &palette[index], 4);
+	}
+	for (x = 0; x < 8 && width >= 8; x++)
+		bad |= (max[x] >= palette_count);
+	return !bad;
+}
+
+/* Each byte of the mask holds eight pixels. Bit 7 is the first pixel. */
+static SSE2 void
+decode_mask_row_sse2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	const __m128i bits_lo = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+	const __m128i bits_hi = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+	const __m128i color = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i m = _mm_set1_epi32(src[x >> 3]);
+		__m128i opaque_lo = _mm_cmpeq_epi32(_mm_and_si128(m, bits_lo), zero);
+		__m128i opaque_hi = _mm_cmpeq_epi32(_mm_and_si128(m, bits_hi), zero);
+		__m128i p0 = _mm_loadu_si128((const __m128i *) (dst + 4*x));
+		__m128i p1 = _mm_loadu_si128((const __m128i *) (dst + 4*x + 16));
+		p0 = _mm_or_si128(_mm_and_si128(p0, color), _mm_and_si128(opaque_lo, alpha));
+		p1 = _mm_or_si128(_mm_and_si128(p1, color), _mm_and_si128(opaque_hi, alpha));
+		_mm_storeu_si128((__m128i *) (dst + 4*x), p0);
+		_mm_storeu_si128((__m128i *) (dst + 4*x + 16), p1);
+	}
+	for (; x < width; x++)
+		dst[4*x+3] = ((src[x >> 3] >> (7 - (x & 7))) & 1) - 1;
+}
+
+static AVX2 void
+decode_mask_row_avx2(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m256i color = _mm256_set1_epi32(0x00FFFFFF);
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	const __m256i zero = _mm256_setzero_si256();
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i m = _mm256_set1_epi32(src[x >> 3]);
+		__m256i opaque = _mm256_cmpeq_epi32(_mm256_and_si256(m, bits), zero);
+		__m256i p = _mm256_loadu_si256((const __m256i *) (dst + 4*x));
+		p = _mm256_or_si256(_mm256_and_si256(p, color), _mm256_and_si256(opaque, alpha));
+		_mm256_storeu_si256((__m256i *) (dst + 4*x), p);
+	}
+	for (; x < width; x++)
+		dst[4*x+3] = ((src[x >> 3] >> (7 - (x & 7))) & 1) - 1;
+}
+
+/* A pixel is transparent if max(alpha, threshold) == threshold. The
+ * comparison result in the alpha byte is the sign bit of each pixel,
+ * which movemask collects with the first pixel in bit 0. */
+static void
+encode_mask_tail(const uint8_t *src, uint8_t *dst, uint32_t x, uint32_t width, uint8_t threshold)
+{
+	for (; x < width; x += 8) {
+		uint32_t c;
+		uint8_t mask = 0;
+
+		for (c = 0; c < 8 && x + c < width; c++)
+			mask |= (src[4*(x+c)+3] <= threshold) << (7 - c);
+		dst[x >> 3] = mask;
+	}
+}
+
+static SSE2 void
+encode_mask_row_sse2(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t threshold)
+{
+	const __m128i limit = _mm_set1_epi8(threshold);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i p0 = _mm_loadu_si128((const __m128i *) (src + 4*x));
+		__m128i p1 = _mm_loadu_si128((const __m128i *) (src + 4*x + 16));
+		__m128i t0 = _mm_cmpeq_epi8(_mm_max_epu8(p0, limit), limit);
+		__m128i t1 = _mm_cmpeq_epi8(_mm_max_epu8(p1, limit), limit);
+		int m0 = _mm_movemask_ps(_mm_castsi128_ps(t0));
+		int m1 = _mm_movemask_ps(_mm_castsi128_ps(t1));
+		dst[x >> 3] = reverse_nibble[m0] << 4 | reverse_nibble[m1];
+	}
+	encode_mask_tail(src, dst, x, width, threshold);
+}
+
+static AVX2 void
+encode_mask_row_avx2(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t threshold)
+{
+	const __m256i limit = _mm256_set1_epi8(threshold);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i p = _mm256_loadu_si256((const __m256i *) (src + 4*x));
+		__m256i t = _mm256_cmpeq_epi8(_mm256_max_epu8(p, limit), limit);
+		int m = _mm256_movemask_ps(_mm256_castsi256_ps(t));
+		dst[x >> 3] = reverse_nibble[m & 15] << 4 | reverse_nibble[m >> 4];
+	}
+	encode_mask_tail(src, dst, x, width, threshold);
+}
+
+/* dib_x86_kernels:
+ *   Replace conversion functions with the fastest ones supported by
+ *   the processor.
+ */
+void
+dib_x86_kernels(DIBKernels *kernels)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2")) {
+		kernels->decode_mask_row = decode_mask_row_sse2;
+		kernels->encode_mask_row = encode_mask_row_sse2;
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		kernels->decode_row_24 = decode_row_24_ssse3;
+		kernels->decode_row_32 = decode_row_32_ssse3;
+		kernels->encode_row_24 = encode_row_24_ssse3;
+		kernels->encode_row_32 = encode_row_32_ssse3;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		kernels->decode_row_4 = decode_row_4_avx2;
+		kernels->decode_row_8 = decode_row_8_avx2;
+		kernels->decode_row_32 = decode_row_32_avx2;
+		kernels->encode_row_32 = encode_row_32_avx2;
+		kernels->decode_mask_row = decode_mask_row_avx2;
+		kernels->encode_mask_row = encode_mask_row_avx2;
+	}
+}
+
+#endif
@@ -0,0 +1,501 @@
+/* dib.c - Conversion of device-independent bitmap rows
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>		/* Gnulib/POSIX */
+#include <string.h>		/* C89 */
+#include "minmax.h"		/* Gnulib */
+#include "icotool.h"
+
+/* Each decoder converts one row of DIB image data to RGBA pixels
+ * (red, green, blue and alpha bytes). Palettized rows are looked up
+ * in a table of 1 << bit_count RGBA colors, of which only the first
+ * palette_count are valid. Decoders return false if the row refers
+ * to a color outside the palette. Alpha is set to 0xFF for all but
+ * 32-bit rows, it is normally replaced with dib_decode_mask_row.
+ *
+ * The functions for common bit depths may be replaced by faster ones
+ * for the processor, see dib-x86.c. */
+
+static bool
+decode_row_1(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	uint32_t x, bad = 0;
+
+	for (x = 0; x < width; x++) {
+		uint32_t index = (src[x >> 3] >> (7 - (x & 7))) & 1;
+		bad |= (index >= palette_count);
+		memcpy(dst + 4*x, &palette[index], 4);
+	}
+	return !bad;
+}
+
+static bool
+decode_row_2(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	uint32_t x, bad = 0;
+
+	for (x = 0; x < width; x++) {
+		uint32_t index = (src[x >> 2] >> ((3 - (x & 3)) << 1)) & 3;
+		bad |= (index >= palette_count);
+		memcpy(dst + 4*x, &palette[index], 4);
+	}
+	return !bad;
+}
+
+static bool
+decode_row_4(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	uint32_t x, bad = 0;
+
+	for (x = 0; x < width; x++) {
+		uint32_t index = (src[x >> 1] >> ((1 - (x & 1)) << 2)) & 15;
+		bad |= (index >= palette_count);
+		memcpy(dst + 4*x, &palette[index], 4);
+	}
+	return !bad;
+}
+
+static bool
+decode_row_8(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	uint32_t x, bad = 0;
+
+	for (x = 0; x < width; x++) {
+		uint32_t index = src[x];
+		bad |= (index >= palette_count);
+		memcpy(dst + 4*x, &palette[index], 4);
+	}
+	return !bad;
+}
+
+static bool
+decode_row_16(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	uint32_t x, bad = 0;
+
+	for (x = 0; x < width; x++) {
+		uint32_t index = src[2*x] | src[2*x+1] << 8;
+		bad |= (index >= palette_count);
+		memcpy(dst + 4*x, &palette[index], 4);
+	}
+	return !bad;
+}
+
+static bool
+decode_row_24(const uint8_t *src, uint8_t *dst, uint32_t width, UNUSED const uint32_t *palette, UNUSED uint32_t palette_count)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		dst[4*x+0] = src[3*x+2];
+		dst[4*x+1] = src[3*x+1];
+		dst[4*x+2] = src[3*x+0];
+		dst[4*x+3] = 0xFF;
+	}
+	return true;
+}
+
+static bool
+decode_row_32(const uint8_t *src, uint8_t *dst, uint32_t width, UNUSED const uint32_t *palette, UNUSED uint32_t palette_count)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		dst[4*x+0] = src[4*x+2];
+		dst[4*x+1] = src[4*x+1];
+		dst[4*x+2] = src[4*x+0];
+		dst[4*x+3] = src[4*x+3];
+	}
+	return true;
+}
+
+/* Unknown bit depths up to 16 bits are treated as all pixels having
+ * color index zero, larger unknown bit depths as all pixels black. */
+static bool
+decode_row_zero_index(UNUSED const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++)
+		memcpy(dst + 4*x, &palette[0], 4);
+	return palette_count > 0;
+}
+
+static bool
+decode_row_black(UNUSED const uint8_t *src, uint8_t *dst, uint32_t width, UNUSED const uint32_t *palette, UNUSED uint32_t palette_count)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		dst[4*x+0] = dst[4*x+1] = dst[4*x+2] = 0;
+		dst[4*x+3] = 0xFF;
+	}
+	return true;
+}
+
+/* encode_row_24, encode_row_32:
+ *   Convert a row of RGBA pixels to 24 or 32-bit DIB image data.
+ */
+static void
+encode_row_24(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		dst[3*x+0] = src[4*x+2];
+		dst[3*x+1] = src[4*x+1];
+		dst[3*x+2] = src[4*x+0];
+	}
+}
+
+static void
+encode_row_32(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		dst[4*x+0] = src[4*x+2];
+		dst[4*x+1] = src[4*x+1];
+		dst[4*x+2] = src[4*x+0];
+		dst[4*x+3] = src[4*x+3];
+	}
+}
+
+/* Set the alpha of RGBA pixels from a row of the AND mask, where
+ * set bits are transparent. */
+static void
+decode_mask_row(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++)
+		dst[4*x+3] = ((src[x >> 3] >> (7 - (x & 7))) & 1) - 1;
+}
+
+/* Make a row of the AND mask from RGBA pixels, where pixels with
+ * alpha not above threshold are transparent. Bits past the last
+ * pixel are cleared. */
+static void
+encode_mask_row(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t threshold)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x += 8) {
+		uint32_t c;
+		uint8_t mask = 0;
+
+		for (c = 0; c < 8 && x + c < width; c++)
+			mask |= (src[4*(x+c)+3] <= threshold) << (7 - c);
+		dst[x >> 3] = mask;
+	}
+}
+
+static const DIBKernels scalar_kernels = {
+	decode_row_4,
+	decode_row_8,
+	decode_row_24,
+	decode_row_32,
+	encode_row_24,
+	encode_row_32,
+	decode_mask_row,
+	encode_mask_row,
+};
+
+#if HAVE_X86_DIB_KERNELS
+
+/* The functions selected for this processor, stored by the first
+ * thread to select them. kernels_state is only accessed with atomic
+ * operations, which HAVE_X86_DIB_KERNELS implies are available. */
+enum { KERNELS_UNSET, KERNELS_STORING, KERNELS_SELECTED, KERNELS_FALLBACK };
+static DIBKernels kernels;
+static int kernels_state = KERNELS_UNSET;
+
+/* Widths used by the self test. These cover rows shorter than one
+ * vector, and both whole and partial trailing vectors. */
+static const uint32_t test_widths[] = { 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 33, 67, 256 };
+#define TEST_WIDTH_MAX	256
+#define TEST_WIDTH_COUNT (sizeof(test_widths) / sizeof(*test_widths))
+
+static void
+fill_test_data(uint8_t *data, uint32_t size, uint32_t seed)
+{
+	uint32_t c;
+
+	for (c = 0; c < size; c++) {
+		seed = seed * 1103515245 + 12345;
+		data[c] = seed >> 16;
+	}
+}
+
+static bool
+test_row_decoder(DIBRowDecoder fn, DIBRowDecoder ref, uint32_t bit_count, const uint32_t *palette)
+{
+	uint8_t src[TEST_WIDTH_MAX * 4];
+	uint8_t dst1[TEST_WIDTH_MAX * 4], dst2[TEST_WIDTH_MAX * 4];
+	uint32_t c, palette_count;
+
+	/* with an incomplete palette, some pixels are out of range */
+	for (palette_count = 200; palette_count <= 256; palette_count += 56) {
+		uint32_t count = palette_count >> (8 - MIN(bit_count, 8));
+
+		for (c = 0; c < TEST_WIDTH_COUNT; c++) {
+			uint32_t width = test_widths[c];
+
+			fill_test_data(src, sizeof(src), width);
+			memset(dst1, 0, sizeof(dst1));
+			memset(dst2, 0, sizeof(dst2));
+			if (fn(src, dst1, width, palette, count) != ref(src, dst2, width, palette, count))
+				return false;
+			if (memcmp(dst1, dst2, sizeof(dst1)) != 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool
+test_row_encoder(DIBRowEncoder fn, DIBRowEncoder ref)
+{
+	uint8_t src[TEST_WIDTH_MAX * 4];
+	uint8_t dst1[TEST_WIDTH_MAX * 4], dst2[TEST_WIDTH_MAX * 4];
+	uint32_t c;
+
+	for (c = 0; c < TEST_WIDTH_COUNT; c++) {
+		uint32_t width = test_widths[c];
+
+		fill_test_data(src, sizeof(src), width);
+		memset(dst1, 0, sizeof(dst1));
+		memset(dst2, 0, sizeof(dst2));
+		fn(src, dst1, width);
+		ref(src, dst2, width);
+		if (memcmp(dst1, dst2, sizeof(dst1)) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool
+test_mask_decoder(DIBMaskDecoder fn, DIBMaskDecoder ref)
+{
+	uint8_t src[TEST_WIDTH_MAX / 8];
+	uint8_t dst1[TEST_WIDTH_MAX * 4], dst2[TEST_WIDTH_MAX * 4];
+	uint32_t c;
+
+	for (c = 0; c < TEST_WIDTH_COUNT; c++) {
+		uint32_t width = test_widths[c];
+
+		fill_test_data(src, sizeof(src), width);
+		fill_test_data(dst1, sizeof(dst1), width + 1);
+		memcpy(dst2, dst1, sizeof(dst2));
+		fn(src, dst1, width);
+		ref(src, dst2, width);
+		if (memcmp(dst1, dst2, sizeof(dst1)) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool
+test_mask_encoder(DIBMaskEncoder fn, DIBMaskEncoder ref)
+{
+	uint8_t src[TEST_WIDTH_MAX * 4];
+	uint8_t dst1[TEST_WIDTH_MAX / 8], dst2[TEST_WIDTH_MAX / 8];
+	uint32_t c, threshold;
+
+	for (threshold = 0; threshold <= 255; threshold += 85) {
+		for (c = 0; c < TEST_WIDTH_COUNT; c++) {
+			uint32_t width = test_widths[c];
+
+			fill_test_data(src, sizeof(src), width);
+			memset(dst1, 0, sizeof(dst1));
+			memset(dst2, 0, sizeof(dst2));
+			fn(src, dst1, width, threshold);
+			ref(src, dst2, width, threshold);
+			if (memcmp(dst1, dst2, sizeof(dst1)) != 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+/* dib_self_test:
+ *   Compare the output of the optimized conversion functions selected
+ *   for this processor with that of the portable ones. Any function
+ *   that does not give the exact same output is replaced with the
+ *   portable one. Returns false if any function was replaced.
+ */
+static bool
+dib_self_test(DIBKernels *k)
+{
+	uint32_t palette[256];
+	bool success = true;
+
+	fill_test_data((uint8_t *) palette, sizeof(palette), 0);
+
+#define TEST_KERNEL(name, test) \
+	if (k->name != scalar_kernels.name && !(test)) { \
+		k->name = scalar_kernels.name; \
+		success = false; \
+	}
+	TEST_KERNEL(decode_row_4, test_row_decoder(k->decode_row_4, scalar_kernels.decode_row_4, 4, palette));
+	TEST_KERNEL(decode_row_8, test_row_decoder(k->decode_row_8, scalar_kernels.decode_row_8, 8, palette));
+	TEST_KERNEL(decode_row_24, test_row_decoder(k->decode_row_24, scalar_kernels.decode_row_24, 24, palette));
+	TEST_KERNEL(decode_row_32, test_row_decoder(k->decode_row_32, scalar_kernels.decode_row_32, 32, palette));
+	TEST_KERNEL(encode_row_24, test_row_encoder(k->encode_row_24, scalar_kernels.encode_row_24));
+	TEST_KERNEL(encode_row_32, test_row_encoder(k->encode_row_32, scalar_kernels.encode_row_32));
+	TEST_KERNEL(decode_mask_row, test_mask_decoder(k->decode_mask_row, scalar_kernels.decode_mask_row));
+	TEST_KERNEL(encode_mask_row, test_mask_encoder(k->encode_mask_row, scalar_kernels.encode_mask_row));
+#undef TEST_KERNEL
+
+	return success;
+}
+
+/* select_kernels:
+ *   Select the conversion functions for this processor into k, and
+ *   store them for later calls if no other thread has. Threads may
+ *   race to do this, which is harmless as they all select the same
+ *   functions. Returns false if the self test failed. This file is
+ *   also part of libicoutils, which must not print anything, so the
+ *   failure is only recorded (see dib_kernels_fallback).
+ */
+static bool
+select_kernels(DIBKernels *k)
+{
+	int state = KERNELS_UNSET;
+	bool passed;
+
+	*k = scalar_kernels;
+	dib_x86_kernels(k);
+	passed = dib_self_test(k);
+	if (__atomic_compare_exchange_n(&kernels_state, &state, KERNELS_STORING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		kernels = *k;
+		__atomic_store_n(&kernels_state, (passed ? KERNELS_SELECTED : KERNELS_FALLBACK), __ATOMIC_RELEASE);
+	}
+	return passed;
+}
+
+/* get_kernels:
+ *   Return the conversion functions for this processor. Until they
+ *   have been stored, they are selected into local.
+ */
+static inline const DIBKernels *
+get_kernels(DIBKernels *local)
+{
+	if (__atomic_load_n(&kernels_state, __ATOMIC_ACQUIRE) >= KERNELS_SELECTED)
+		return &kernels;
+	select_kernels(local);
+	return local;
+}
+
+/* dib_kernels_fallback:
+ *   Return true if any of the optimized conversion functions failed
+ *   the self test, so that the portable one is used instead.
+ */
+bool
+dib_kernels_fallback(void)
+{
+	int state = __atomic_load_n(&kernels_state, __ATOMIC_ACQUIRE);
+	DIBKernels local;
+
+	if (state >= KERNELS_SELECTED)
+		return state == KERNELS_FALLBACK;
+	return !select_kernels(&local);
+}
+
+#else
+
+/* Without optimized functions there is nothing to select. */
+static inline const DIBKernels *
+get_kernels(UNUSED DIBKernels *local)
+{
+	return &scalar_kernels;
+}
+
+bool
+dib_kernels_fallback(void)
+{
+	return false;
+}
+
+#endif
+
+/* dib_row_decoder:
+ *   Return the function converting rows of the specified bit depth.
+ */
+DIBRowDecoder
+dib_row_decoder(uint32_t bit_count)
+{
+	DIBKernels local;
+
+	switch (bit_count) {
+	case 1:
+		return decode_row_1;
+	case 2:
+		return decode_row_2;
+	case 4:
+		return get_kernels(&local)->decode_row_4;
+	case 8:
+		return get_kernels(&local)->decode_row_8;
+	case 16:
+		return decode_row_16;
+	case 24:
+		return get_kernels(&local)->decode_row_24;
+	case 32:
+		return get_kernels(&local)->decode_row_32;
+	}
+
+	return (bit_count <= 16 ? decode_row_zero_index : decode_row_black);
+}
+
+/* dib_row_encoder:
+ *   Return the function converting RGBA pixels to rows of the
+ *   specified bit depth, which must be 24 or 32.
+ */
+DIBRowEncoder
+dib_row_encoder(uint32_t bit_count)
+{
+	DIBKernels local;
+	const DIBKernels *k = get_kernels(&local);
+
+	return (bit_count == 24 ? k->encode_row_24 : k->encode_row_32);
+}
+
+/* dib_decode_mask_row:
+ *   Set the alpha of RGBA pixels from a row of the AND mask, where
+ *   set bits are transparent.
+ */
+void
+dib_decode_mask_row(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+	DIBKernels local;
+
+	get_kernels(&local)->decode_mask_row(src, dst, width);
+}
+
+/* dib_encode_mask_row:
+ *   Make a row of the AND mask from RGBA pixels. Pixels with an
+ *   alpha value not above threshold are transparent.
+ */
+void
+dib_encode_mask_row(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t threshold)
+{
+	DIBKernels local;
+
+	get_kernels(&local)->encode_mask_row(src, dst, width, threshold);
+}
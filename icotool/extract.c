@@ -45,6 +45,7 @@
 #include "common/string-utils.h"
 #include "common/io-utils.h"
 #include "common/error.h"
+#include "common/jobs.h"
 #include "icotool.h"
 #include "win32-endian.h"
 
@@ -55,8 +56,11 @@
 #define FALSE	0
 #define TRUE	1
 
-static uint32_t simple_vec(uint8_t *data, uint32_t ofs, uint8_t size);
+static uint32_t *make_rgba_palette(Win32RGBQuad *palette, uint32_t palette_count, uint32_t bit_count);
 static int read_png(uint8_t *image_data, uint32_t image_size, uint32_t *bit_count, uint32_t *width, uint32_t *height);
+static int read_png_header(uint8_t *header, uint32_t *bit_count, uint32_t *width, uint32_t *height);
+
+JsonWriter *list_json = NULL;
 
 static bool
 xfread(void *ptr, size_t size, FILE *stream)
@@ -71,6 +75,54 @@ xfread(void *ptr, size_t size, FILE *stream)
 	return true;
 }
 
+/* Where an icon file is read from: either a stream, or a block of
+ * memory if file is NULL. */
+typedef struct {
+	FILE *file;
+	const uint8_t *data;
+	uint32_t size;
+	uint32_t pos;
+} IconInput;
+
+static bool
+input_read(IconInput *in, void *ptr, size_t size)
+{
+	if (in->file != NULL)
+		return xfread(ptr, size, in->file);
+	if (size > in->size - in->pos) {
+		in->pos = in->size;
+		warn(_("premature end"));
+		return false;
+	}
+	memcpy(ptr, in->data + in->pos, size);
+	in->pos += size;
+	return true;
+}
+
+static int
+input_skip(IconInput *in, uint32_t bytes)
+{
+	if (in->file != NULL)
+		return fskip(in->file, bytes);
+	if (bytes > in->size - in->pos) {
+		in->pos = in->size;
+		return -1;
+	}
+	in->pos += bytes;
+	return 0;
+}
+
+static int
+input_seek(IconInput *in, uint32_t offset)
+{
+	if (in->file != NULL)
+		return fseeko(in->file, offset, SEEK_SET);
+	if (offset > in->size)
+		return -1;
+	in->pos = offset;
+	return 0;
+}
+
 struct png_mem_in
 {
 	uint8_t* ptr;
@@ -93,19 +145,217 @@ static void png_read_mem (png_structp png, png_bytep data, png_size_t size)
 
 
 
-int
-extract_icons(FILE *in, char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter)
+/* An image that has been read from the icon file and is ready to be
+ * written, possibly by a worker process. */
+typedef struct {
+	char *inname;
+	ExtractNameGen outfile_gen;
+	int index;
+	bool is_png;
+	bool top_down;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bit_count;
+	uint8_t *image_data;
+	uint32_t image_size;
+	uint8_t *mask_data;
+	uint32_t mask_size;
+	Win32RGBQuad *palette;
+	uint32_t palette_count;
+} ExtractLayer;
+
+/* extract_layer:
+ *   Write an image to the file chosen by outfile_gen, converting DIB
+ *   images to PNG. The image data is not freed. Returns non-zero on
+ *   failure, so it can be used as a job.
+ */
+static int
+extract_layer(void *data)
 {
+	ExtractLayer *layer = data;
+	png_structp png_ptr = NULL;
+	png_infop info_ptr = NULL;
+	uint32_t *rgba_palette = NULL;
+	DIBRowDecoder decode_row;
+	png_byte *row = NULL;
+	char *outname;
+	FILE *out;
+	uint32_t d;
+	int status = 1;
+
+	if (!layer->is_png) {
+		png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
+		if (!png_ptr) {
+			warn(_("cannot initialize PNG library"));
+			return 1;
+		}
+		info_ptr = png_create_info_struct(png_ptr);
+		if (!info_ptr) {
+			warn(_("cannot create PNG info structure - out of memory"));
+			png_destroy_write_struct(&png_ptr, NULL);
+			return 1;
+		}
+	}
+
+	outname = layer->inname;
+	out = layer->outfile_gen(&outname, layer->width, layer->height, layer->bit_count, layer->index);
+	restore_message_header();
+	set_message_header(outname);
+
+	if (out == NULL) {
+		warn_errno(_("cannot create file"));
+		goto done;
+	}
+
+	restore_message_header();
+	set_message_header(layer->inname);
+
+	if (layer->is_png) {
+		if (fwrite(layer->image_data, layer->image_size, 1, out) != 1) {
+			warn_errno(_("cannot write to file"));
+			goto done;
+		}
+		status = 0;
+		goto done;
+	}
+
+	png_init_io(png_ptr, out);
+	png_set_IHDR(png_ptr, info_ptr,	layer->width, layer->height, 8,
+			PNG_COLOR_TYPE_RGB_ALPHA,
+			PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT,
+			PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+
+	row = xmalloc(layer->width * 4);
+	decode_row = dib_row_decoder(layer->bit_count);
+	if (layer->bit_count <= 16)
+		rgba_palette = make_rgba_palette(layer->palette, layer->palette_count, layer->bit_count);
+
+	for (d = 0; d < layer->height; d++) {
+		uint32_t y = (layer->top_down ? d : layer->height - d - 1);
+
+		if (!decode_row(layer->image_data + y * (layer->image_size / layer->height), row, layer->width, rgba_palette, layer->palette_count)) {
+			warn("color out of range in image data");
+			goto done;
+		}
+		if (layer->bit_count != 32)
+			dib_decode_mask_row(layer->mask_data + y * (layer->mask_size / layer->height), row, layer->width);
+
+		png_write_row(png_ptr, row);
+	}
+
+	png_write_end(png_ptr, info_ptr);
+	status = 0;
+
+done:
+	if (png_ptr != NULL)
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+	free(row);
+	free(rgba_palette);
+	if (out != NULL && out != stdout)
+		fclose(out);
+	else if (out != NULL)
+		fflush(out);
+	if (outname != layer->inname)
+		free(outname);
+	return status;
+}
+
+/* compare_entry_offsets:
+ *   Order directory entries by the offset of their image data, and
+ *   entries with the same offset by their position in the directory.
+ */
+static int
+compare_entry_offsets(const void *a, const void *b)
+{
+	const Win32CursorIconFileDirEntry *e1 = *(const Win32CursorIconFileDirEntry **) a;
+	const Win32CursorIconFileDirEntry *e2 = *(const Win32CursorIconFileDirEntry **) b;
+
+	if (e1->dib_offset != e2->dib_offset)
+		return (e1->dib_offset < e2->dib_offset ? -1 : 1);
+	return (e1 < e2 ? -1 : e1 > e2);
+}
+
+/* list_image:
+ *   Describe a matching image, as a line of the options that select
+ *   it or as a JSON record if list_json is set.
+ */
+static void
+list_image(char *inname, bool icon, int index, uint32_t width, uint32_t height, uint32_t bit_count, uint32_t palette_count, Win32CursorIconFileDirEntry *entry)
+{
+	if (list_json != NULL) {
+		json_writer_begin(list_json);
+		json_writer_string(list_json, "file", inname);
+		json_writer_string(list_json, "type", (icon ? "icon" : "cursor"));
+		json_writer_int(list_json, "index", index);
+		json_writer_uint(list_json, "offset", entry->dib_offset);
+		json_writer_uint(list_json, "size", entry->dib_size);
+		json_writer_uint(list_json, "width", width);
+		json_writer_uint(list_json, "height", height);
+		json_writer_uint(list_json, "bit_depth", bit_count);
+		json_writer_uint(list_json, "palette_size", palette_count);
+		if (!icon) {
+			json_writer_uint(list_json, "hotspot_x", entry->hotspot_x);
+			json_writer_uint(list_json, "hotspot_y", entry->hotspot_y);
+		}
+		json_writer_end(list_json);
+		return;
+	}
+
+	printf(_("--%s --index=%d --width=%d --height=%d --bit-depth=%d --palette-size=%d"),
+			(icon ? "icon" : "cursor"), index, width, height,
+			bit_count, palette_count);
+	if (!icon)
+		printf(_(" --hotspot-x=%d --hotspot-y=%d"), entry->hotspot_x, entry->hotspot_y);
+	printf("\n");
+}
+
+/* list_coverage:
+ *   Describe how the image data of a file was laid out, as a JSON
+ *   record if list_json is set. Ranges are the runs of image data
+ *   separated by gaps. Text listings only have the warnings about
+ *   each gap and overlap.
+ */
+static void
+list_coverage(char *inname, uint32_t ranges, uint32_t gap_bytes, uint32_t overlaps, uint32_t overlap_bytes)
+{
+	if (list_json == NULL)
+		return;
+	json_writer_begin(list_json);
+	json_writer_string(list_json, "file", inname);
+	json_writer_string(list_json, "type", "coverage");
+	json_writer_uint(list_json, "ranges", ranges);
+	json_writer_uint(list_json, "gap_bytes", gap_bytes);
+	json_writer_uint(list_json, "overlaps", overlaps);
+	json_writer_uint(list_json, "overlap_bytes", overlap_bytes);
+	json_writer_end(list_json);
+}
+
+/* extract_icons_from_input:
+ *   List or extract the images of an icon or cursor file. With jobs
+ *   greater than one, images are converted and written by that many
+ *   worker processes while the file is being read. Returns the number
+ *   of images matched, or -1 on error.
+ */
+static int
+extract_icons_from_input(IconInput *in, char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter, int jobs)
+{
+	JobPool *pool = NULL;
 	Win32CursorIconFileDir dir;
 	Win32CursorIconFileDirEntry *entries = NULL;
+	Win32CursorIconFileDirEntry **sorted = NULL;
 	uint32_t offset;
-	uint32_t c, d;
+	uint32_t c, n;
+	uint32_t ranges = 0, gap_bytes = 0, overlaps = 0, overlap_bytes = 0;
 	int completed = 0;
 	int matched = 0;
 
 	set_message_header(inname);
+	if (!listmode && jobs > 1)
+		pool = job_pool_new(jobs);
 
-	if (!xfread(&dir, sizeof(Win32CursorIconFileDir), in))
+	if (!input_read(in, &dir, sizeof(Win32CursorIconFileDir)))
 		goto cleanup;
 	fix_win32_cursor_icon_file_dir_endian(&dir);
 
@@ -120,7 +370,7 @@ extract_icons(FILE *in, char *inname, bool listmode, ExtractNameGen outfile_gen,
 
 	entries = xmalloc(dir.count * sizeof(Win32CursorIconFileDirEntry));
 	for (c = 0; c < dir.count; c++) {
-		if (!xfread(&entries[c], sizeof(Win32CursorIconFileDirEntry), in))
+		if (!input_read(in, &entries[c], sizeof(Win32CursorIconFileDirEntry)))
 			goto cleanup;
 		fix_win32_cursor_icon_file_dir_entry_endian(&entries[c]);
 		if (entries[c].reserved != 0)
@@ -128,312 +378,291 @@ extract_icons(FILE *in, char *inname, bool listmode, ExtractNameGen outfile_gen,
 	}
 	offset = sizeof(Win32CursorIconFileDir) + dir.count * sizeof(Win32CursorIconFileDirEntry);
 
-	while(completed < dir.count) {
-		uint32_t min_offset = UINT32_MAX;
-		int previous = completed;
-		
-		for (c = 0; c < dir.count; c++) {
-			if (entries[c].dib_offset == offset) {
-				Win32BitmapInfoHeader bitmap;
-				Win32RGBQuad *palette = NULL;
-				uint32_t palette_count = 0;
-				uint32_t image_size, mask_size;
-				uint32_t width, height, bit_count;
-				uint8_t *image_data = NULL, *mask_data = NULL;
-				png_structp png_ptr = NULL;
-				png_infop info_ptr = NULL;
-				png_byte *row = NULL;
-				char *outname = NULL;
-				FILE *out = NULL;
-				int do_next = FALSE;
-
-				if (!xfread(&bitmap, sizeof(Win32BitmapInfoHeader), in))
-					goto done;
+	/* Read images in the order they are stored, so that the file is
+	 * read in a single forward sweep no matter how the directory is
+	 * ordered. Gaps are skipped, and images that overlap data already
+	 * read are reread if the file is seekable. */
+	sorted = xmalloc(dir.count * sizeof(Win32CursorIconFileDirEntry *));
+	for (c = 0; c < dir.count; c++)
+		sorted[c] = &entries[c];
+	qsort(sorted, dir.count, sizeof(Win32CursorIconFileDirEntry *), compare_entry_offsets);
+
+	for (n = 0; n < dir.count; n++) {
+		Win32BitmapInfoHeader bitmap;
+		uint8_t header[sizeof(Win32BitmapInfoHeader)];
+		Win32RGBQuad *palette = NULL;
+		ExtractLayer layer = { inname, outfile_gen };
+		uint32_t palette_count = 0;
+		uint32_t image_size, mask_size;
+		uint32_t width, height, bit_count;
+		uint8_t *image_data = NULL, *mask_data = NULL;
+		int do_next = FALSE;
+
+		c = sorted[n] - entries;
+		if (n == 0 || entries[c].dib_offset > offset)
+			ranges++;
+		if (entries[c].dib_offset > offset) {
+			gap_bytes += entries[c].dib_offset - offset;
+			warn(_("skipping %u bytes of garbage at %u"), entries[c].dib_offset - offset, offset);
+			input_skip(in, entries[c].dib_offset - offset);
+			offset = entries[c].dib_offset;
+		} else if (entries[c].dib_offset < offset) {
+			overlaps++;
+			overlap_bytes += offset - entries[c].dib_offset;
+			warn(_("image data at %u overlaps data ending at %u"), entries[c].dib_offset, offset);
+			if (input_seek(in, entries[c].dib_offset) != 0) {
+				warn(_("offset of bitmap header incorrect (too low)"));
+				goto cleanup;
+			}
+			offset = entries[c].dib_offset;
+		}
 
-				fix_win32_bitmap_info_header_endian(&bitmap);
-				/* Vista icon: it's just a raw PNG */
-				if (bitmap.size == ICO_PNG_MAGIC)
-				{
-					fseek(in, offset, SEEK_SET);
-				
-					image_size = entries[c].dib_size;
-					image_data = xmalloc(image_size);
-					if (!xfread(image_data, image_size, in))
-						goto done;
-					
-					if (!read_png (image_data, image_size, &bit_count, &width, &height))
-						goto done;
-					
-					completed++;
-					
-					if (!filter(completed, width, height, bitmap.bit_count, palette_count, dir.type == 1,
-							(dir.type == 1 ? 0 : entries[c].hotspot_x),
-								(dir.type == 1 ? 0 : entries[c].hotspot_y))) {
-						do_next = TRUE;
-						goto done;
-					}
-					matched++;
-
-					if (listmode) {
-						printf(_("--%s --index=%d --width=%d --height=%d --bit-depth=%d --palette-size=%d"),
-								(dir.type == 1 ? "icon" : "cursor"), completed, width, height,
-								bit_count, palette_count);
-						if (dir.type == 2)
-							printf(_(" --hotspot-x=%d --hotspot-y=%d"), entries[c].hotspot_x, entries[c].hotspot_y);
-						printf("\n");
-					} else {
-						outname = inname;
-						out = outfile_gen(&outname, width, height, bit_count, completed);
-						restore_message_header();
-						set_message_header(outname);
-
-						if (out == NULL) {
-							warn_errno(_("cannot create file"));
-							goto done;
-						}
-
-						restore_message_header();
-						set_message_header(inname);
-
-						if (fwrite(image_data, image_size, 1, out) != 1) {
-							warn_errno(_("cannot write to file"));
-							goto cleanup;
-						}
-					}
-					offset += image_size;
+		if (!input_read(in, &bitmap, sizeof(Win32BitmapInfoHeader)))
+			goto done;
+
+		memcpy(header, &bitmap, sizeof(Win32BitmapInfoHeader));
+		fix_win32_bitmap_info_header_endian(&bitmap);
+		/* Vista icon: it's just a raw PNG */
+		if (bitmap.size == ICO_PNG_MAGIC)
+		{
+			image_size = entries[c].dib_size;
+
+			if (listmode && image_size >= sizeof(Win32BitmapInfoHeader)) {
+				/* only the header is needed for listing */
+				if (!read_png_header (header, &bit_count, &width, &height))
+					goto done;
+				if (input_skip(in, image_size - sizeof(Win32BitmapInfoHeader)) != 0) {
+					warn(_("premature end"));
+					goto done;
 				}
-				else
-				{
-					if (bitmap.size < sizeof(Win32BitmapInfoHeader)) {
-						warn(_("bitmap header is too short"));
-						goto done;
-					}
-					if (bitmap.compression != 0) {
-						warn(_("compressed image data not supported"));
-						goto done;
-					}
-					if (bitmap.x_pels_per_meter != 0)
-						warn(_("x_pels_per_meter field in bitmap should be zero"));
-					if (bitmap.y_pels_per_meter != 0)
-						warn(_("y_pels_per_meter field in bitmap should be zero"));
-					if (bitmap.clr_important != 0)
-						warn(_("clr_important field in bitmap should be zero"));
-					if (bitmap.planes != 1)
-						warn(_("planes field in bitmap should be one"));
-					if (bitmap.size != sizeof(Win32BitmapInfoHeader)) {
-						uint32_t skip = bitmap.size - sizeof(Win32BitmapInfoHeader);
-						warn(_("skipping %d bytes of extended bitmap header"), skip);
-						fskip(in, skip);
-					}
-					offset += bitmap.size;
-
-					if (bitmap.clr_used != 0 || bitmap.bit_count < 24) {
-						palette_count = (bitmap.clr_used != 0 ? bitmap.clr_used : 1 << bitmap.bit_count);
-						palette = xmalloc(sizeof(Win32RGBQuad) * palette_count);
-						if (!xfread(palette, sizeof(Win32RGBQuad) * palette_count, in))
-							goto done;
-						offset += sizeof(Win32RGBQuad) * palette_count;
-					}
-
-					width = bitmap.width;
-					height = abs(bitmap.height)/2;
-				
-					image_size = height * ROW_BYTES(width * bitmap.bit_count);
-					mask_size = height * ROW_BYTES(width);
-
-					if (entries[c].dib_size	!= bitmap.size + image_size + mask_size + palette_count * sizeof(Win32RGBQuad))
-						warn(_("incorrect total size of bitmap (%d specified; %d real)"),
-						    entries[c].dib_size,
-						    bitmap.size + image_size + mask_size + palette_count * sizeof(Win32RGBQuad)
-						);
-
-					image_data = xmalloc(image_size);
-					if (!xfread(image_data, image_size, in))
-						goto done;
+			} else {
+				/* the header already read is the start of the PNG
+				 * data, so there is no need to seek back over it */
+				image_data = xmalloc(MAX(image_size, sizeof(Win32BitmapInfoHeader)));
+				memcpy(image_data, header, sizeof(Win32BitmapInfoHeader));
+				if (image_size > sizeof(Win32BitmapInfoHeader)
+				    && !input_read(in, image_data + sizeof(Win32BitmapInfoHeader), image_size - sizeof(Win32BitmapInfoHeader)))
+					goto done;
 
-					mask_data = xmalloc(mask_size);
-					if (!xfread(mask_data, mask_size, in))
-						goto done;
+				if (!read_png (image_data, image_size, &bit_count, &width, &height))
+					goto done;
+			}
+			offset += image_size;
+			completed++;
+
+			if (!filter(completed, width, height, bit_count, palette_count, dir.type == 1,
+					(dir.type == 1 ? 0 : entries[c].hotspot_x),
+						(dir.type == 1 ? 0 : entries[c].hotspot_y))) {
+				do_next = TRUE;
+				goto done;
+			}
+			matched++;
 
-					offset += image_size;
-					offset += mask_size;
-					completed++;
+			if (listmode) {
+				list_image(inname, dir.type == 1, completed, width, height, bit_count, palette_count, &entries[c]);
+			} else {
+				layer.is_png = true;
+				layer.index = completed;
+				layer.width = width;
+				layer.height = height;
+				layer.bit_count = bit_count;
+				layer.image_data = image_data;
+				layer.image_size = image_size;
+				if (pool != NULL)
+					job_pool_submit(pool, extract_layer, &layer);
+				else if (extract_layer(&layer) != 0)
+					goto done;
+			}
+		}
+		else
+		{
+			if (bitmap.size < sizeof(Win32BitmapInfoHeader)) {
+				warn(_("bitmap header is too short"));
+				goto done;
+			}
+			if (bitmap.compression != 0) {
+				warn(_("compressed image data not supported"));
+				goto done;
+			}
+			if (bitmap.x_pels_per_meter != 0)
+				warn(_("x_pels_per_meter field in bitmap should be zero"));
+			if (bitmap.y_pels_per_meter != 0)
+				warn(_("y_pels_per_meter field in bitmap should be zero"));
+			if (bitmap.clr_important != 0)
+				warn(_("clr_important field in bitmap should be zero"));
+			if (bitmap.planes != 1)
+				warn(_("planes field in bitmap should be one"));
+			if (bitmap.size != sizeof(Win32BitmapInfoHeader)) {
+				uint32_t skip = bitmap.size - sizeof(Win32BitmapInfoHeader);
+				warn(_("skipping %d bytes of extended bitmap header"), skip);
+				input_skip(in, skip);
+			}
+			offset += bitmap.size;
 
-					if (!filter(completed, width, height, bitmap.bit_count, palette_count, dir.type == 1,
-							(dir.type == 1 ? 0 : entries[c].hotspot_x),
-								(dir.type == 1 ? 0 : entries[c].hotspot_y))) {
-						do_next = TRUE;
+			if (bitmap.clr_used != 0 || bitmap.bit_count < 24) {
+				palette_count = (bitmap.clr_used != 0 ? bitmap.clr_used : 1 << bitmap.bit_count);
+				if (!listmode) {
+					palette = xmalloc(sizeof(Win32RGBQuad) * palette_count);
+					if (!input_read(in, palette, sizeof(Win32RGBQuad) * palette_count))
 						goto done;
-					}
-					matched++;
-
-					if (!listmode) {
-						png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
-						if (!png_ptr) {
-							warn(_("cannot initialize PNG library"));
-							goto done;
-						}
-						info_ptr = png_create_info_struct(png_ptr);
-						if (!info_ptr) {
-							warn(_("cannot create PNG info structure - out of memory"));
-							goto done;
-						}
-
-						outname = inname;
-						out = outfile_gen(&outname, width, height, bitmap.bit_count, completed);
-						restore_message_header();
-						set_message_header(outname);
-
-						if (out == NULL) {
-							warn_errno(_("cannot create file"));
-							goto done;
-						}
-						png_init_io(png_ptr, out);
-
-						restore_message_header();
-						set_message_header(inname);
-
-						png_set_IHDR(png_ptr, info_ptr,	width, height, 8,
-								PNG_COLOR_TYPE_RGB_ALPHA,
-								PNG_INTERLACE_NONE,
-								PNG_COMPRESSION_TYPE_DEFAULT,
-								PNG_FILTER_TYPE_DEFAULT);
-						png_write_info(png_ptr, info_ptr);
-					}
-
-					row = xmalloc(width * 4);
-
-					for (d = 0; d < height; d++) {
-						uint32_t x;
-						uint32_t y = (bitmap.height < 0 ? d : height - d - 1);
-						uint32_t imod = y * (image_size / height) * 8 / bitmap.bit_count;
-						uint32_t mmod = y * (mask_size / height) * 8;
-
-						for (x = 0; x < width; x++) {
-							uint32_t color = simple_vec(image_data, x + imod, bitmap.bit_count);
-
-							if (bitmap.bit_count <= 16) {
-								if (color >= palette_count) {
-									warn("color out of range in image data");
-									goto done;
-								}
-								row[4*x+0] = palette[color].red;
-								row[4*x+1] = palette[color].green;
-								row[4*x+2] = palette[color].blue;
-							} else {
-								row[4*x+0] = (color >> 16) & 0xFF;
-								row[4*x+1] = (color >>  8) & 0xFF;
-								row[4*x+2] = (color >>  0) & 0xFF;
-							}
-							if (bitmap.bit_count == 32)
-							    row[4*x+3] = (color >> 24) & 0xFF;
-							else
-							    row[4*x+3] = simple_vec(mask_data, x + mmod, 1) ? 0 : 0xFF;
-						}
-
-						if (!listmode)
-							png_write_row(png_ptr, row);
-					}
-
-					if (listmode) {
-						printf(_("--%s --index=%d --width=%d --height=%d --bit-depth=%d --palette-size=%d"),
-								(dir.type == 1 ? "icon" : "cursor"), completed, width, height,
-								bitmap.bit_count, palette_count);
-						if (dir.type == 2)
-							printf(_(" --hotspot-x=%d --hotspot-y=%d"), entries[c].hotspot_x, entries[c].hotspot_y);
-						printf("\n");
-					} else {
-						png_write_end(png_ptr, info_ptr);
-						png_destroy_write_struct(&png_ptr, &info_ptr);
-						/*restore_message_header();*/
-					}
 				}
-				
-			do_next = TRUE;
-			done:
+				offset += sizeof(Win32RGBQuad) * palette_count;
+			}
 
-				if (row != NULL) {
-					free(row);
-					row = NULL;
-				}
-				if (palette != NULL) {
-					free(palette);
-					palette = NULL;
-				}
-				if (image_data != NULL) {
-					free(image_data);
-					image_data = NULL;
-				}
-				if(mask_data != NULL) {
-					free(mask_data);
-					mask_data = NULL;
-				}
-				if (out != NULL) {
-					fclose(out);
-					out = NULL;
-				}
-				if (outname != NULL) {
-					free(outname);
-					outname = NULL;
-				}
-				if (do_next == TRUE) {
-					continue;
-				} else {
-					goto cleanup;
+			width = bitmap.width;
+			height = abs(bitmap.height)/2;
+		
+			image_size = height * ROW_BYTES(width * bitmap.bit_count);
+			mask_size = height * ROW_BYTES(width);
+
+			if (entries[c].dib_size	!= bitmap.size + image_size + mask_size + palette_count * sizeof(Win32RGBQuad))
+				warn(_("incorrect total size of bitmap (%d specified; %d real)"),
+				    entries[c].dib_size,
+				    bitmap.size + image_size + mask_size + palette_count * sizeof(Win32RGBQuad)
+				);
+
+			if (listmode) {
+				/* neither palette nor pixels are needed for listing */
+				if (input_skip(in, sizeof(Win32RGBQuad) * palette_count + image_size + mask_size) != 0) {
+					warn(_("premature end"));
+					goto done;
 				}
 			} else {
-				if (entries[c].dib_offset > offset)
-					min_offset = MIN(min_offset, entries[c].dib_offset);
+				image_data = xmalloc(image_size);
+				if (!input_read(in, image_data, image_size))
+					goto done;
+
+				mask_data = xmalloc(mask_size);
+				if (!input_read(in, mask_data, mask_size))
+					goto done;
 			}
-		}
 
-		if (previous == completed) {
-			if (min_offset < offset) {
-				warn(_("offset of bitmap header incorrect (too low)"));
-				goto cleanup;
+			offset += image_size;
+			offset += mask_size;
+			completed++;
+
+			if (!filter(completed, width, height, bitmap.bit_count, palette_count, dir.type == 1,
+					(dir.type == 1 ? 0 : entries[c].hotspot_x),
+						(dir.type == 1 ? 0 : entries[c].hotspot_y))) {
+				do_next = TRUE;
+				goto done;
 			}
-			if ((min_offset-offset) == 0) {
-				warn(_("invalid data at expected offset (unrecoverable)"));
-				goto cleanup;
+			matched++;
+
+			if (listmode) {
+				list_image(inname, dir.type == 1, completed, width, height, bitmap.bit_count, palette_count, &entries[c]);
+				do_next = TRUE;
+				goto done;
 			}
-			warn(_("skipping %u bytes of garbage at %u"), min_offset-offset, offset);
-			fskip(in, min_offset - offset);
-			offset = min_offset;
+
+			layer.is_png = false;
+			layer.index = completed;
+			layer.width = width;
+			layer.height = height;
+			layer.bit_count = bitmap.bit_count;
+			layer.top_down = bitmap.height < 0;
+			layer.image_data = image_data;
+			layer.image_size = image_size;
+			layer.mask_data = mask_data;
+			layer.mask_size = mask_size;
+			layer.palette = palette;
+			layer.palette_count = palette_count;
+			if (pool != NULL)
+				job_pool_submit(pool, extract_layer, &layer);
+			else if (extract_layer(&layer) != 0)
+				goto done;
+		}
+
+		do_next = TRUE;
+	done:
+
+		if (palette != NULL) {
+			free(palette);
+			palette = NULL;
+		}
+		if (image_data != NULL) {
+			free(image_data);
+			image_data = NULL;
+		}
+		if(mask_data != NULL) {
+			free(mask_data);
+			mask_data = NULL;
+		}
+		if (do_next == TRUE) {
+			continue;
+		} else {
+			goto cleanup;
 		}
 	}
 
+	if (listmode)
+		list_coverage(inname, ranges, gap_bytes, overlaps, overlap_bytes);
 	restore_message_header();
+	free(sorted);
 	free(entries);
+	if (list_json != NULL)
+		json_writer_flush(list_json);
+	if (pool != NULL && !job_pool_finish(pool))
+		return -1;
 	return matched;
 
 cleanup:
 
 	restore_message_header();
+	free(sorted);
 	free(entries);
+	if (list_json != NULL)
+		json_writer_flush(list_json);
+	if (pool != NULL)
+		job_pool_finish(pool);
 	return -1;
 }
 
-static uint32_t
-simple_vec(uint8_t *data, uint32_t ofs, uint8_t size)
+/* extract_icons:
+ *   List or extract the images of an icon or cursor file read from
+ *   a stream.
+ */
+int
+extract_icons(FILE *in, char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter, int jobs)
+{
+	IconInput input = { in, NULL, 0, 0 };
+
+	return extract_icons_from_input(&input, inname, listmode, outfile_gen, filter, jobs);
+}
+
+/* extract_icons_from_memory:
+ *   List or extract the images of an icon or cursor file that has
+ *   already been read into memory.
+ */
+int
+extract_icons_from_memory(const void *data, uint32_t size, char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter, int jobs)
+{
+	IconInput input = { NULL, data, size, 0 };
+
+	return extract_icons_from_input(&input, inname, listmode, outfile_gen, filter, jobs);
+}
+
+/* make_rgba_palette:
+ *   Make a table of all colors that may be referred to by pixels of
+ *   the specified bit depth, for use with a DIBRowDecoder. Colors not
+ *   in the bitmap palette are black.
+ */
+static uint32_t *
+make_rgba_palette(Win32RGBQuad *palette, uint32_t palette_count, uint32_t bit_count)
 {
-	switch (size) {
-	case 1:
-		return (data[ofs/8] >> (7 - ofs%8)) & 1;
-	case 2:
-		return (data[ofs/4] >> ((3 - ofs%4) << 1)) & 3;
-	case 4:
-		return (data[ofs/2] >> ((1 - ofs%2) << 2)) & 15;
-	case 8:
-		return data[ofs];
-	case 16:
-		return data[2*ofs] | data[2*ofs+1] << 8;
-	case 24:
-		return data[3*ofs] | data[3*ofs+1] << 8 | data[3*ofs+2] << 16;
-	case 32:
-		return data[4*ofs] | data[4*ofs+1] << 8 | data[4*ofs+2] << 16 | data[4*ofs+3] << 24;
+	uint32_t size = 1 << bit_count;
+	uint32_t *table = xcalloc(size, sizeof(uint32_t));
+	uint32_t c;
+
+	for (c = 0; c < MIN(palette_count, size); c++) {
+		uint8_t *color = (uint8_t *) &table[c];
+		color[0] = palette[c].red;
+		color[1] = palette[c].green;
+		color[2] = palette[c].blue;
+		color[3] = 0xFF;
 	}
 
-	return 0;
+	return table;
 }
 
 static int
@@ -484,3 +713,31 @@ read_png(uint8_t *image_data, uint32_t image_size, uint32_t *bit_count, uint32_t
 	return TRUE;
 }
 
+/* read_png_header:
+ *   Get the dimensions and bit depth of a PNG image from its
+ *   signature and IHDR chunk, the same way as read_png does.
+ */
+static int
+read_png_header(uint8_t *header, uint32_t *bit_count, uint32_t *width, uint32_t *height)
+{
+	uint8_t bit_depth, color_type;
+
+	if (png_sig_cmp(header, 0, 8) != 0 || memcmp(header + 12, "IHDR", 4) != 0) {
+		warn(_("invalid PNG header"));
+		return FALSE;
+	}
+
+	*width = (uint32_t) header[16] << 24 | header[17] << 16 | header[18] << 8 | header[19];
+	*height = (uint32_t) header[20] << 24 | header[21] << 16 | header[22] << 8 | header[23];
+	bit_depth = header[24];
+	color_type = header[25];
+
+	if (color_type & PNG_COLOR_MASK_PALETTE)
+		*bit_count = bit_depth;
+	else if (color_type & PNG_COLOR_MASK_COLOR)
+		*bit_count = bit_depth * (color_type & PNG_COLOR_MASK_ALPHA ? 4 : 3);
+	else
+		*bit_count = bit_depth * (color_type & PNG_COLOR_MASK_ALPHA ? 2 : 1);
+
+	return TRUE;
+}
@@ -23,24 +23,56 @@
 #include <stdint.h>		/* POSIX/Gnulib */
 #include <stdio.h>		/* C89 */
 #include "common/common.h"
+#include "common/json.h"
 
 typedef struct _Palette Palette;
 
 /* palette.c */
+size_t palette_size(void);
+void palette_init(Palette *palette);
 Palette *palette_new(void);
 void palette_free(Palette *palette);
 void palette_add(Palette *palette, uint8_t r, uint8_t g, uint8_t b);
 bool palette_next(Palette *palette, uint8_t *r, uint8_t *g, uint8_t *b);
-void palette_assign_indices(Palette *palette);
+bool palette_full(Palette *palette);
 uint32_t palette_lookup(Palette *palette, uint8_t r, uint8_t g, uint8_t b);
 uint32_t palette_count(Palette *palette);
 
+/* dib.c */
+typedef bool (*DIBRowDecoder)(const uint8_t *src, uint8_t *dst, uint32_t width, const uint32_t *palette, uint32_t palette_count);
+typedef void (*DIBRowEncoder)(const uint8_t *src, uint8_t *dst, uint32_t width);
+typedef void (*DIBMaskDecoder)(const uint8_t *src, uint8_t *dst, uint32_t width);
+typedef void (*DIBMaskEncoder)(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t threshold);
+typedef struct {
+	DIBRowDecoder decode_row_4;
+	DIBRowDecoder decode_row_8;
+	DIBRowDecoder decode_row_24;
+	DIBRowDecoder decode_row_32;
+	DIBRowEncoder encode_row_24;
+	DIBRowEncoder encode_row_32;
+	DIBMaskDecoder decode_mask_row;
+	DIBMaskEncoder encode_mask_row;
+} DIBKernels;
+DIBRowDecoder dib_row_decoder(uint32_t bit_count);
+DIBRowEncoder dib_row_encoder(uint32_t bit_count);
+void dib_decode_mask_row(const uint8_t *src, uint8_t *dst, uint32_t width);
+void dib_encode_mask_row(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t threshold);
+bool dib_kernels_fallback(void);
+
+/* dib-x86.c */
+#if defined __GNUC__ && __GNUC__ >= 5 && (defined __x86_64__ || defined __i386__)
+#define HAVE_X86_DIB_KERNELS 1
+void dib_x86_kernels(DIBKernels *kernels);
+#endif
+
 /* extract.c */
 typedef FILE *(*ExtractNameGen)(char **outname, int width, int height, int bitcount, int index);
 typedef bool (*ExtractFilter)(int index, int width, int height, int bitdepth, int palettesize, bool icon, int hotspot_x, int hotspot_y);
-int extract_icons(FILE *in, char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter);
+int extract_icons(FILE *in, char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter, int jobs);
+int extract_icons_from_memory(const void *data, uint32_t size, char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter, int jobs);
+extern JsonWriter *list_json;	/* if not NULL, list images as records */
 
 /* create.c */
 typedef FILE *(*CreateNameGen)(char **outname);
-bool create_icon(int filec, char **filev, int raw_filec, char** raw_filev, CreateNameGen outfile_gen, bool icon_mode, int32_t hotspot_x, int32_t hotspot_y, int32_t alpha_threshold, int32_t bit_count);
+bool create_icon(int filec, char **filev, int raw_filec, char** raw_filev, CreateNameGen outfile_gen, bool icon_mode, int32_t hotspot_x, int32_t hotspot_y, int32_t alpha_threshold, int32_t bit_count, int jobs);
 #endif
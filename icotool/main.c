@@ -23,6 +23,7 @@
 #include <getopt.h>		/* Gnulib/GNU Libc */
 #include <string.h>		/* C89 */
 #include <stdlib.h>		/* C89 */
+#include <fcntl.h>		/* POSIX */
 #include "gettext.h"
 #include "configmake.h"
 #define _(s) gettext(s)
@@ -35,6 +36,7 @@
 #include "common/string-utils.h"
 #include "common/intutil.h"
 #include "common/io-utils.h"
+#include "common/jobs.h"
 #include "icotool.h"
 
 #define PROGRAM "icotool"
@@ -52,6 +54,8 @@ static bool hotspot_y_set = false;
 static int32_t alpha_threshold = 127;
 static bool icon_only = false;	
 static bool cursor_only = false;
+static int32_t jobs = 1;
+static bool recursive = false;
 static char *output = NULL;
 
 const char version_etc_copyright[] = "Copyright (C) 1998 Oskar Liljeblad";
@@ -61,9 +65,12 @@ enum {
     HELP_OPT,
     ICON_OPT,
     CURSOR_OPT,
+    BATCH_OPT,
+    RECURSIVE_OPT,
+    FORMAT_OPT,
 };
 
-static char *short_opts = "xlco:i:w:h:p:b:X:Y:t:r:";
+static char *short_opts = "xlco:i:w:h:p:b:X:Y:t:r:j:";
 static struct option long_opts[] = {
     { "extract",		no_argument,    	NULL, 'x' },
     { "list",			no_argument,		NULL, 'l' },
@@ -83,6 +90,10 @@ static struct option long_opts[] = {
     { "icon",       	 	no_argument,       	NULL, ICON_OPT	},
     { "cursor",     	 	no_argument,       	NULL, CURSOR_OPT },
     { "raw", 			required_argument, 	NULL, 'r' },
+    { "jobs", 			required_argument, 	NULL, 'j' },
+    { "batch", 			no_argument, 		NULL, BATCH_OPT },
+    { "recursive", 		no_argument, 		NULL, RECURSIVE_OPT },
+    { "format", 		required_argument, 	NULL, FORMAT_OPT },
     { 0, 0, 0, 0 }
 };
 
@@ -184,6 +195,16 @@ display_help(void)
     printf(_("      --icon                   match icons only\n"));
     printf(_("      --cursor                 match cursors only\n"));
     printf(_("  -o, --output=PATH            where to place extracted files\n"));
+    printf(_("      --format=FORMAT          list as `text' (default) or `json', one\n"
+	     "                               record per line\n"));
+    printf(_("  -j, --jobs=N                 convert up to N images at the same time, or\n"
+	     "                               process up to N files with --recursive\n"));
+    printf(_("      --recursive              list or extract the icon and cursor files in\n"
+	     "                               directories recursively\n"));
+    printf(_("      --batch                  read files to list or extract from standard\n"
+	     "                               input, one per line, optionally followed by\n"
+	     "                               a tab and the output path, and write a status\n"
+	     "                               line for each\n"));
     printf(_("\n"));
     printf(_("Report bugs to <%s>.\n"), PACKAGE_BUGREPORT);
 }
@@ -205,6 +226,160 @@ open_file_or_stdin(char *name, FILE **outfile, char **outname)
     return true;
 }
 
+/* process_batch:
+ *   List or extract the files named on standard input, writing a
+ *   status line `ok COUNT' for each, COUNT being the number of
+ *   images matched, or `error' if the file could not be processed.
+ */
+static void
+process_batch(bool list_mode)
+{
+    char *default_output = output;
+    char *line = NULL;
+    size_t size = 0;
+
+    while (getline(&line, &size, stdin) >= 0) {
+	char *fields[2];
+	int matched = -1;
+	FILE *in;
+
+	chomp(line);
+	if (line[0] == '\0')
+	    continue;
+	string_split_c(line, '\t', fields, 2);
+	output = (fields[1] != NULL && fields[1][0] != '\0' ? fields[1] : default_output);
+
+	if (!list_mode && output != NULL && strcmp(output, "-") == 0) {
+	    /* standard out is reserved for status lines */
+	    warn(_("%s: cannot extract to standard out in batch mode"), fields[0]);
+	} else if ((in = fopen(fields[0], "rb")) == NULL) {
+	    warn_errno("%s", fields[0]);
+	} else {
+	    if (list_mode)
+		matched = extract_icons(in, fields[0], true, NULL, filter, 1);
+	    else
+		matched = extract_icons(in, fields[0], false, extract_outfile_gen, filter, jobs);
+	    fclose(in);
+	}
+
+	if (matched == -1)
+	    printf("error\n");
+	else
+	    printf("ok %d\n", matched);
+	fflush(stdout);
+    }
+
+    free(line);
+    output = default_output;
+}
+
+/* is_icon_file:
+ *   Check the header of a file found by --recursive, so that only
+ *   icon and cursor files are handed to jobs. Other files are
+ *   skipped without a warning.
+ */
+static bool
+is_icon_file(const char *name)
+{
+    uint8_t header[6];
+    bool is_icon;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd == -1) {
+	warn_errno("%s", name);
+	return false;
+    }
+    is_icon = read(fd, header, sizeof(header)) == sizeof(header)
+	    && header[0] == 0 && header[1] == 0
+	    && (header[2] == 1 || header[2] == 2) && header[3] == 0
+	    && (header[4] != 0 || header[5] != 0);
+    close(fd);
+    return is_icon;
+}
+
+/* process_file:
+ *   List or extract the images of one file. This is run as a job,
+ *   possibly in a worker process of its own, so the images of the
+ *   file are converted one at a time.
+ */
+static int
+process_file(char *name, bool list_mode)
+{
+    FILE *in;
+    char *inname;
+    int matched;
+
+    if (!open_file_or_stdin(name, &in, &inname))
+	return 1;
+    if (list_mode) {
+	matched = extract_icons(in, inname, true, NULL, filter, 1);
+    } else {
+	matched = extract_icons(in, inname, false, extract_outfile_gen, filter, 1);
+	if (matched == 0)
+	    fprintf(stderr, _("%s: no images matched\n"), inname);
+    }
+    if (in != stdin)
+	fclose(in);
+    return matched == -1;
+}
+
+static int
+list_file_job(void *data)
+{
+    return process_file(data, true);
+}
+
+static int
+extract_file_job(void *data)
+{
+    return process_file(data, false);
+}
+
+/* process_recursive:
+ *   List or extract the files named by the arguments and the icon
+ *   and cursor files below the directories named, up to jobs files
+ *   at the same time. Returns false if any file or directory could
+ *   not be read.
+ */
+static bool
+process_recursive(int argc, char **argv, bool list_mode)
+{
+    job_fn_t fn = (list_mode ? list_file_job : extract_file_job);
+    JobPool *pool = job_pool_new(jobs);
+    bool success = true;
+    int c;
+
+    for (c = 0; c < argc; c++) {
+	DirWalker *walker;
+	const char *name;
+
+	if (!is_directory(argv[c])) {
+	    job_pool_submit(pool, fn, argv[c]);
+	    continue;
+	}
+	walker = dir_walker_new(argv[c]);
+	if (walker == NULL) {
+	    warn_errno("%s", argv[c]);
+	    success = false;
+	    continue;
+	}
+	while ((name = dir_walker_next(walker)) != NULL) {
+	    /* the job has been run or its worker forked when submit
+	     * returns, so the name need not outlive the call */
+	    if (is_icon_file(name))
+		job_pool_submit(pool, fn, (char *) name);
+	}
+	if (dir_walker_failed(walker))
+	    success = false;
+	dir_walker_free(walker);
+    }
+
+    if (!job_pool_finish(pool))
+	success = false;
+    return success;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -212,6 +387,8 @@ main(int argc, char **argv)
     bool list_mode = false;
     bool extract_mode = false;
     bool create_mode = false;
+    bool batch_mode = false;
+    bool json_format = false;
     FILE *in;
     char *inname;
     int raw_filec = 0;
@@ -291,6 +468,24 @@ main(int argc, char **argv)
 	    raw_filev[raw_filec] = optarg;
 	    raw_filec++;
 	    break;
+	case 'j':
+	    if (!parse_int32(optarg, &jobs) || jobs < 1)
+		die(_("invalid jobs value: %s"), optarg);
+	    break;
+	case BATCH_OPT:
+	    batch_mode = true;
+	    break;
+	case RECURSIVE_OPT:
+	    recursive = true;
+	    break;
+	case FORMAT_OPT:
+	    if (strcmp(optarg, "json") == 0 || strcmp(optarg, "ndjson") == 0)
+		json_format = true;
+	    else if (strcmp(optarg, "text") == 0)
+		json_format = false;
+	    else
+		die(_("invalid format value: %s"), optarg);
+	    break;
 	case ICON_OPT:
 	    icon_only = true;
 	    break;
@@ -311,13 +506,41 @@ main(int argc, char **argv)
     }
     if (icon_only && cursor_only)
 	die(_("only one of --icon and --cursor may be specified"));
+    if (json_format) {
+	if (list_mode)
+	    list_json = json_writer_new(stdout);
+	else
+	    warn(_("--format has no effect without --list"));
+    }
+    if (!list_mode && dib_kernels_fallback())
+	warn(_("optimized pixel conversion failed its self test, using portable code"));
+
+    if (batch_mode) {
+	if (create_mode)
+	    die(_("--batch cannot be used with --create"));
+	if (recursive)
+	    die(_("only one of --batch and --recursive may be specified"));
+	if (argc-optind > 0)
+	    die(_("file arguments cannot be used with --batch"));
+	process_batch(list_mode);
+	exit(0);
+    }
+
+    if (recursive) {
+	if (create_mode)
+	    die(_("--recursive cannot be used with --create"));
+	if (argc-optind <= 0)
+	    die(_("missing file argument"));
+	exit(process_recursive(argc-optind, argv+optind, list_mode) ? 0 : 1);
+    }
 
     if (list_mode) {
 	if (argc-optind <= 0)
 	    die(_("missing file argument"));
 	for (c = optind ; c < argc ; c++) {
 	    if (open_file_or_stdin(argv[c], &in, &inname)) {
-		if (!extract_icons(in, inname, true, NULL, filter))
+		/* exit on errors, and when nothing matched */
+		if (extract_icons(in, inname, true, NULL, filter, 1) <= 0)
 		    exit(1);
 		if (in != stdin)
 		    fclose(in);
@@ -333,7 +556,7 @@ main(int argc, char **argv)
             int matched;
 
 	    if (open_file_or_stdin(argv[c], &in, &inname)) {
-	        matched = extract_icons(in, inname, false, extract_outfile_gen, filter);
+	        matched = extract_icons(in, inname, false, extract_outfile_gen, filter, jobs);
 	        if (matched == -1)
 	            exit(1);
                 if (matched == 0)
@@ -347,7 +570,7 @@ main(int argc, char **argv)
     if (create_mode) {
         if (argc-optind+raw_filec <= 0)
 	    die(_("missing arguments"));
-        if (!create_icon(argc-optind, argv+optind, raw_filec, raw_filev, create_outfile_gen, (icon_only ? true : !cursor_only), hotspot_x, hotspot_y, alpha_threshold, bitdepth))
+        if (!create_icon(argc-optind, argv+optind, raw_filec, raw_filev, create_outfile_gen, (icon_only ? true : !cursor_only), hotspot_x, hotspot_y, alpha_threshold, bitdepth, jobs))
             exit(1);
     }
 
@@ -19,117 +19,136 @@
 #include <config.h>
 #include <stdint.h>		/* Gnulib/POSIX */
 #include <stdlib.h>		/* C89 */
-#include "xalloc.h"		/* Gnulib */
+#include <string.h>		/* C89 */
 #include "icotool.h"
-#include "common/hmap.h"
 #include "common/common.h"
 
-typedef struct {
-	uint8_t red;
-	uint8_t green;
-	uint8_t blue;
-	uint32_t index;
-} PaletteColor;
+/* Colors are kept in a fixed open-addressed table keyed on the packed
+ * 0xRRGGBB value. An icon palette never holds more than 256 colors, so
+ * the table stops growing at PALETTE_MAX_COLORS (one more than fits,
+ * which is enough for the caller to tell that the image needs 24 bpp).
+ * Indices are handed out in insertion order.
+ */
+#define PALETTE_MAX_COLORS	257
+#define PALETTE_TABLE_BITS	9
+#define PALETTE_TABLE_SIZE	(1 << PALETTE_TABLE_BITS)
+#define PALETTE_EMPTY		UINT32_MAX
+
+#define PACK_COLOR(r,g,b)	(((uint32_t) (r) << 16) | ((uint32_t) (g) << 8) | (uint32_t) (b))
 
 struct _Palette {
-	HMap *map;
-	HMapIterator it;
-	bool it_init;
+	uint32_t keys[PALETTE_TABLE_SIZE];
+	uint16_t indices[PALETTE_TABLE_SIZE];
+	uint32_t colors[PALETTE_MAX_COLORS];
+	uint32_t count;
+	uint32_t last_key;
+	uint32_t it_pos;
 };
 
 static uint32_t
-color_hash(PaletteColor *color)
+color_slot(uint32_t key)
 {
-	return (color->red << 16) | (color->green << 8) | color->blue;
+	return (key * UINT32_C(0x9E3779B1)) >> (32 - PALETTE_TABLE_BITS);
 }
 
-static int32_t
-color_compare(PaletteColor *c1, PaletteColor *c2)
+/* find_slot:
+ *   Return the slot holding KEY, or the empty slot where it
+ *   would be inserted.
+ */
+static uint32_t
+find_slot(Palette *palette, uint32_t key)
+{
+	uint32_t slot = color_slot(key);
+
+	while (palette->keys[slot] != PALETTE_EMPTY && palette->keys[slot] != key)
+		slot = (slot + 1) & (PALETTE_TABLE_SIZE - 1);
+	return slot;
+}
+
+/* palette_size, palette_init:
+ *   Palettes may live in memory allocated by the caller, which must
+ *   be palette_size() bytes and be initialized with palette_init.
+ */
+size_t
+palette_size(void)
+{
+	return sizeof(Palette);
+}
+
+void
+palette_init(Palette *palette)
 {
-	if (c1->red != c2->red)
-		return c1->red - c2->red;
-	if (c1->green != c2->green)
-		return c1->green - c2->green;
-	if (c1->blue != c2->blue)
-		return c1->blue - c2->blue;
-	return 0;
+	memset(palette->keys, 0xFF, sizeof(palette->keys));
+	palette->count = 0;
+	palette->last_key = PALETTE_EMPTY;
+	palette->it_pos = 0;
 }
 
+/* palette_new:
+ *   Allocate a palette with malloc. Returns NULL if out of memory.
+ */
 Palette *
 palette_new(void)
 {
-	Palette *palette = xmalloc(sizeof(Palette));
-	palette->map = hmap_new();
-	palette->it_init = false;
-	hmap_set_hash_fn(palette->map, (hash_fn_t) color_hash);
-	hmap_set_compare_fn(palette->map, (comparison_fn_t) color_compare);
+	Palette *palette = malloc(sizeof(Palette));
+	if (palette != NULL)
+		palette_init(palette);
 	return palette;
 }
 
 void
 palette_free(Palette *palette)
 {
-	hmap_foreach_value(palette->map, free);
-	hmap_free(palette->map);
 	free(palette);
 }
 
 void
 palette_add(Palette *palette, uint8_t r, uint8_t g, uint8_t b)
 {
-	PaletteColor color = { r, g, b, 0 };
-
-	if (!hmap_contains_key(palette->map, &color)) {
-		PaletteColor *new_color = xmalloc(sizeof(PaletteColor));
-		new_color->red = r;
-		new_color->green = g;
-		new_color->blue = b;
-		new_color->index = 0;
-		hmap_put(palette->map, new_color, new_color);
+	uint32_t key = PACK_COLOR(r, g, b);
+	uint32_t slot;
+
+	if (key == palette->last_key || palette->count >= PALETTE_MAX_COLORS)
+		return;
+	palette->last_key = key;
+	slot = find_slot(palette, key);
+	if (palette->keys[slot] == PALETTE_EMPTY) {
+		palette->keys[slot] = key;
+		palette->indices[slot] = palette->count;
+		palette->colors[palette->count++] = key;
 	}
 }
 
 bool
 palette_next(Palette *palette, uint8_t *r, uint8_t *g, uint8_t *b)
 {
-	if (!palette->it_init) {
-		hmap_iterator(palette->map, &palette->it);
-		palette->it_init = true;
-	}
-	if (palette->it.has_next(&palette->it)) {
-		PaletteColor *color = palette->it.next(&palette->it);
-		*r = color->red;
-		*g = color->green;
-		*b = color->blue;
+	if (palette->it_pos < palette->count) {
+		uint32_t key = palette->colors[palette->it_pos++];
+		*r = key >> 16;
+		*g = key >> 8;
+		*b = key;
 		return true;
 	}
-	palette->it_init = false;
+	palette->it_pos = 0;
 	return false;
 }
 
-void
-palette_assign_indices(Palette *palette)
-{
-	HMapIterator it;
-	uint32_t c;
-
-	hmap_iterator(palette->map, &it);
-	for (c = 0; it.has_next(&it); c++) {
-		PaletteColor *color = it.next(&it);
-		color->index = c;
-	}
-}
-
 uint32_t
 palette_lookup(Palette *palette, uint8_t r, uint8_t g, uint8_t b)
 {
-	PaletteColor color = { r, g, b, 0 };
-	PaletteColor *real_color = hmap_get(palette->map, &color);
-	return (real_color != NULL ? real_color->index : -1);
+	uint32_t key = PACK_COLOR(r, g, b);
+	uint32_t slot = find_slot(palette, key);
+	return (palette->keys[slot] != PALETTE_EMPTY ? palette->indices[slot] : -1);
 }
 
 uint32_t
 palette_count(Palette *palette)
 {
-	return hmap_size(palette->map);
+	return palette->count;
+}
+
+bool
+palette_full(Palette *palette)
+{
+	return palette->count >= PALETTE_MAX_COLORS;
 }
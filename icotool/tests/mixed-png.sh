@@ -0,0 +1,36 @@
+#!/bin/sh
+# mixed-png.sh - List and extract images selected by a filter from an
+# icon holding both PNG and bitmap images. Images rejected by the
+# filter must still be skipped over correctly.
+
+ICOTOOL=${ICOTOOL:-./icotool}
+srcdir=${srcdir:-.}
+tmp=mixed-png.tmp
+
+trap 'rm -f $tmp.ico $tmp.png $tmp.err' 0
+
+$ICOTOOL -c -o $tmp.ico -r $srcdir/tests/partial-alpha.png \
+  -r $srcdir/tests/circle-32.png $srcdir/tests/circle-32.png || exit 1
+
+listing=`$ICOTOOL -l --index=3 $tmp.ico 2>$tmp.err` || exit 1
+expected="--icon --index=3 --width=32 --height=32 --bit-depth=32 --palette-size=0"
+if test "$listing" != "$expected" || test -s $tmp.err; then
+  echo "mixed-png: got \`$listing' for --index=3" >&2
+  cat $tmp.err >&2
+  exit 1
+fi
+
+# the bit depth of PNG images is that of the PNG data
+count=`$ICOTOOL -l --bit-depth=32 $tmp.ico | wc -l` || exit 1
+if test $count -ne 2; then
+  echo "mixed-png: $count images listed for --bit-depth=32" >&2
+  exit 1
+fi
+
+$ICOTOOL -x --index=3 -o $tmp.png $tmp.ico 2>$tmp.err || exit 1
+cmp $tmp.png $srcdir/tests/circle-32.png >/dev/null && test ! -s $tmp.err || {
+  echo "mixed-png: PNG image not extracted unchanged" >&2
+  cat $tmp.err >&2
+  exit 1
+}
+exit 0
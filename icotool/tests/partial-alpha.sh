@@ -0,0 +1,27 @@
+#!/bin/sh
+# partial-alpha.sh - Create an icon from an image whose pixels all
+# have the same partial alpha level. One level fits the AND mask, so
+# the image needs a palette of all its eleven colors.
+
+ICOTOOL=${ICOTOOL:-./icotool}
+srcdir=${srcdir:-.}
+tmp=partial-alpha.tmp
+
+trap 'rm -f $tmp.ico $tmp.png $tmp-2.ico' 0
+
+$ICOTOOL -c -o $tmp.ico $srcdir/tests/partial-alpha.png || exit 1
+listing=`$ICOTOOL -l $tmp.ico` || exit 1
+expected="--icon --index=1 --width=16 --height=16 --bit-depth=4 --palette-size=16"
+if test "$listing" != "$expected"; then
+  echo "partial-alpha: got \`$listing'" >&2
+  exit 1
+fi
+
+# the colors must survive extraction and recreation unchanged
+$ICOTOOL -x -o $tmp.png $tmp.ico || exit 1
+$ICOTOOL -c -o $tmp-2.ico $tmp.png || exit 1
+cmp $tmp.ico $tmp-2.ico >/dev/null || {
+  echo "partial-alpha: colors changed when extracted" >&2
+  exit 1
+}
+exit 0
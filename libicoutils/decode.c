@@ -0,0 +1,321 @@
+/* decode.c - Decode icon and cursor files in memory
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <setjmp.h>		/* C89 */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <string.h>		/* C89 */
+#if HAVE_PNG_H
+# include <png.h>
+#else
+# if HAVE_LIBPNG_PNG_H
+#  include <libpng/png.h>
+# else
+#  if HAVE_LIBPNG10_PNG_H
+#   include <libpng10/png.h>
+#  else
+#   if HAVE_LIBPNG12_PNG_H
+#    include <libpng12/png.h>
+#   endif
+#  endif
+# endif
+#endif
+#include "minmax.h"		/* Gnulib */
+#include "icotool/icotool.h"
+#include "private.h"
+
+typedef struct {
+	const IcoAllocator *allocator;
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+	bool out_of_memory;	/* an allocation by libpng failed */
+} PNGSource;
+
+static png_voidp
+png_alloc(png_structp png_ptr, png_alloc_size_t size)
+{
+	PNGSource *src = png_get_mem_ptr(png_ptr);
+	void *ptr = ico_alloc(src->allocator, size);
+
+	if (ptr == NULL)
+		src->out_of_memory = true;
+	return ptr;
+}
+
+static void
+png_free_mem(png_structp png_ptr, png_voidp ptr)
+{
+	PNGSource *src = png_get_mem_ptr(png_ptr);
+	ico_free(src->allocator, ptr);
+}
+
+static void
+png_read_data(png_structp png_ptr, png_bytep data, png_size_t size)
+{
+	PNGSource *src = png_get_io_ptr(png_ptr);
+
+	if (size > src->size - src->pos)
+		png_error(png_ptr, "premature end");
+	memcpy(data, src->data + src->pos, size);
+	src->pos += size;
+}
+
+static void
+png_error_jump(png_structp png_ptr, UNUSED png_const_charp message)
+{
+	longjmp(png_jmpbuf(png_ptr), 1);
+}
+
+static void
+png_warning_ignore(UNUSED png_structp png_ptr, UNUSED png_const_charp message)
+{
+}
+
+/* decode_png:
+ *   Decode a PNG image to RGBA pixels. The libpng structures are
+ *   allocated with the caller's allocator too.
+ */
+static IcoStatus
+decode_png(const uint8_t *data, size_t size, const IcoAllocator *allocator, IcoImage *img)
+{
+	PNGSource src = { allocator, data, size, 0, false };
+	png_structp png_ptr;
+	png_infop info_ptr;
+	uint8_t *volatile pixels = NULL;
+	png_bytep *volatile rows = NULL;
+	uint32_t y;
+	png_byte ct;
+
+	png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL,
+			png_error_jump, png_warning_ignore,
+			&src, png_alloc, png_free_mem);
+	if (png_ptr == NULL)
+		return ICO_ERROR_MEMORY;
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return ICO_ERROR_MEMORY;
+	}
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		ico_free(allocator, rows);
+		ico_free(allocator, pixels);
+		if (src.out_of_memory)
+			return ICO_ERROR_MEMORY;
+		return (src.pos >= src.size ? ICO_ERROR_TRUNCATED : ICO_ERROR_FORMAT);
+	}
+
+	png_set_read_fn(png_ptr, &src, png_read_data);
+	png_read_info(png_ptr, info_ptr);
+
+	img->png = true;
+	img->width = png_get_image_width(png_ptr, info_ptr);
+	img->height = png_get_image_height(png_ptr, info_ptr);
+	ct = png_get_color_type(png_ptr, info_ptr);
+	if (ct & PNG_COLOR_MASK_PALETTE)
+		img->bit_count = png_get_bit_depth(png_ptr, info_ptr);
+	else
+		img->bit_count = png_get_bit_depth(png_ptr, info_ptr) * png_get_channels(png_ptr, info_ptr);
+	img->palette_size = 0;
+
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	if (!(ct & PNG_COLOR_MASK_COLOR))
+		png_set_gray_to_rgb(png_ptr);
+	if (!(ct & PNG_COLOR_MASK_ALPHA) && !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+		png_set_add_alpha(png_ptr, 0xFF, PNG_FILLER_AFTER);
+	png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	if ((uint64_t) img->width * img->height * 4 > SIZE_MAX)
+		png_error(png_ptr, "image too large");
+	pixels = ico_alloc(allocator, (size_t) img->width * img->height * 4);
+	rows = ico_alloc(allocator, img->height * sizeof(png_bytep));
+	if (pixels == NULL || rows == NULL) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		ico_free(allocator, rows);
+		ico_free(allocator, pixels);
+		return ICO_ERROR_MEMORY;
+	}
+	for (y = 0; y < img->height; y++)
+		rows[y] = pixels + (size_t) y * img->width * 4;
+	png_read_image(png_ptr, rows);
+	png_read_end(png_ptr, NULL);
+
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	ico_free(allocator, rows);
+	img->pixels = pixels;
+	return ICO_OK;
+}
+
+/* decode_dib:
+ *   Decode a device-independent bitmap with its AND mask to RGBA
+ *   pixels. Like icotool, the total size recorded in the directory
+ *   is not trusted; the bitmap may extend to the end of the data.
+ */
+static IcoStatus
+decode_dib(const uint8_t *data, size_t size, const IcoAllocator *allocator, IcoImage *img)
+{
+	DIBRowDecoder decode_row;
+	uint32_t header_size, bit_count, clr_used, palette_count = 0;
+	uint64_t image_row_size, mask_row_size, row_size;
+	uint32_t *palette = NULL;
+	const uint8_t *image_data, *mask_data;
+	int32_t width, height;
+	bool top_down;
+	uint32_t c, d;
+
+	if (size < BITMAP_HEADER_SIZE)
+		return ICO_ERROR_TRUNCATED;
+	header_size = get_le32(data);
+	width = get_le32(data + 4);
+	height = get_le32(data + 8);
+	bit_count = get_le16(data + 14);
+	clr_used = get_le32(data + 32);
+	if (header_size < BITMAP_HEADER_SIZE || width <= 0 || height / 2 == 0 || bit_count == 0 || bit_count > 32)
+		return ICO_ERROR_FORMAT;
+	if (get_le32(data + 16) != 0)
+		return ICO_ERROR_UNSUPPORTED;
+
+	top_down = height < 0;
+	img->width = width;
+	img->height = (height < 0 ? -(int64_t) height : height) / 2;
+	img->bit_count = bit_count;
+	if (clr_used != 0 || bit_count < 24)
+		palette_count = (clr_used != 0 ? clr_used : 1U << bit_count);
+	img->palette_size = palette_count;
+
+	/* The sizes are compared by division, so that the products
+	 * below cannot overflow. */
+	image_row_size = ROW_BYTES((uint64_t) img->width * bit_count);
+	mask_row_size = ROW_BYTES((uint64_t) img->width);
+	row_size = image_row_size + (bit_count != 32 ? mask_row_size : 0);
+	if (header_size > size || palette_count > (size - header_size) / 4
+	    || row_size > (size - header_size - (size_t) palette_count * 4) / img->height)
+		return ICO_ERROR_TRUNCATED;
+	if (img->width > SIZE_MAX / 4 / img->height)
+		return ICO_ERROR_MEMORY;
+	image_data = data + header_size + (size_t) palette_count * 4;
+	mask_data = image_data + img->height * image_row_size;
+
+	/* A table of all colors pixels may refer to, see make_rgba_palette
+	 * in icotool/extract.c. */
+	if (bit_count <= 16) {
+		uint32_t table_size = 1 << bit_count;
+
+		palette = ico_alloc(allocator, table_size * sizeof(uint32_t));
+		if (palette == NULL)
+			return ICO_ERROR_MEMORY;
+		memset(palette, 0, table_size * sizeof(uint32_t));
+		for (c = 0; c < MIN(palette_count, table_size); c++) {
+			const uint8_t *quad = data + header_size + c * 4;
+			uint8_t *color = (uint8_t *) &palette[c];
+			color[0] = quad[2];
+			color[1] = quad[1];
+			color[2] = quad[0];
+			color[3] = 0xFF;
+		}
+	}
+
+	img->pixels = ico_alloc(allocator, (size_t) img->width * img->height * 4);
+	if (img->pixels == NULL) {
+		ico_free(allocator, palette);
+		return ICO_ERROR_MEMORY;
+	}
+
+	decode_row = dib_row_decoder(bit_count);
+	for (d = 0; d < img->height; d++) {
+		uint32_t y = (top_down ? d : img->height - d - 1);
+		uint8_t *row = img->pixels + (size_t) d * img->width * 4;
+
+		if (!decode_row(image_data + (size_t) y * image_row_size, row, img->width, palette, palette_count)) {
+			ico_free(allocator, palette);
+			ico_free(allocator, img->pixels);
+			img->pixels = NULL;
+			return ICO_ERROR_FORMAT;
+		}
+		if (bit_count != 32)
+			dib_decode_mask_row(mask_data + (size_t) y * mask_row_size, row, img->width);
+	}
+
+	ico_free(allocator, palette);
+	return ICO_OK;
+}
+
+/* ico_decode:
+ *   Decode all images of an icon or cursor file. On success the
+ *   images should be freed with ico_file_free.
+ */
+IcoStatus
+ico_decode(const void *data, size_t size, const IcoAllocator *allocator, IcoFile *file)
+{
+	static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	const uint8_t *bytes = data;
+	uint32_t type, count, c;
+
+	file->count = 0;
+	file->images = NULL;
+
+	if (size < ICO_HEADER_SIZE)
+		return ICO_ERROR_TRUNCATED;
+	type = get_le16(bytes + 2);
+	if (get_le16(bytes) != 0 || (type != 1 && type != 2))
+		return ICO_ERROR_FORMAT;
+	count = get_le16(bytes + 4);
+	if (size < ICO_HEADER_SIZE + (size_t) count * ICO_ENTRY_SIZE)
+		return ICO_ERROR_TRUNCATED;
+	file->cursor = (type == 2);
+	if (count == 0)
+		return ICO_OK;
+
+	file->images = ico_alloc(allocator, count * sizeof(IcoImage));
+	if (file->images == NULL)
+		return ICO_ERROR_MEMORY;
+	memset(file->images, 0, count * sizeof(IcoImage));
+
+	for (c = 0; c < count; c++) {
+		const uint8_t *entry = bytes + ICO_HEADER_SIZE + c * ICO_ENTRY_SIZE;
+		IcoImage *img = &file->images[c];
+		uint32_t dib_size = get_le32(entry + 8);
+		uint32_t dib_offset = get_le32(entry + 12);
+		IcoStatus status;
+
+		file->count = c + 1;
+		if (dib_offset >= size) {
+			ico_file_free(file, allocator);
+			return ICO_ERROR_TRUNCATED;
+		}
+		if (size - dib_offset >= sizeof(png_signature)
+		    && memcmp(bytes + dib_offset, png_signature, sizeof(png_signature)) == 0) {
+			status = decode_png(bytes + dib_offset, MIN(dib_size, size - dib_offset), allocator, img);
+		} else {
+			status = decode_dib(bytes + dib_offset, size - dib_offset, allocator, img);
+		}
+		if (status != ICO_OK) {
+			ico_file_free(file, allocator);
+			return status;
+		}
+		if (file->cursor) {
+			img->hotspot_x = get_le16(entry + 4);
+			img->hotspot_y = get_le16(entry + 6);
+		}
+	}
+
+	return ICO_OK;
+}
@@ -0,0 +1,251 @@
+/* encode.c - Encode icon and cursor files in memory
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <string.h>		/* C89 */
+#include "minmax.h"		/* Gnulib */
+#include "icotool/icotool.h"
+#include "private.h"
+
+typedef struct {
+	Palette *palette;
+	uint32_t bit_count;
+	uint32_t palette_count;
+	uint32_t image_size;
+	uint32_t mask_size;
+	uint32_t dib_size;
+} EncodeLayout;
+
+/* supported_bit_count:
+ *   Round a requested bit depth up to one that icons can be stored in.
+ */
+static uint32_t
+supported_bit_count(uint32_t bit_count)
+{
+	if (bit_count > 24)
+		return 32;
+	if (bit_count > 8)
+		return 24;
+	if (bit_count > 4)
+		return 8;
+	if (bit_count > 1)
+		return 4;
+	return bit_count;
+}
+
+/* needs_transparency:
+ *   Return true if the alpha levels seen cannot be kept in the AND
+ *   mask, which holds any one level or both 0 and 255.
+ */
+static bool
+needs_transparency(const uint8_t *transparency, uint32_t transparency_count)
+{
+	return transparency_count > 2
+	    || (transparency_count == 2 && (transparency[0] == 0 || transparency[255] == 0));
+}
+
+/* analyze_image:
+ *   Find out which bit depth and palette an image needs. This makes
+ *   the same choice as analyze_png in icotool/create.c, with the bit
+ *   depth of the image as the least depth to use.
+ */
+static void
+analyze_image(const IcoImage *img, EncodeLayout *layout)
+{
+	uint8_t transparency[256];
+	uint32_t transparency_count = 0;
+	bool need_transparency;
+	bool count_colors = true;
+	uint32_t bit_count;
+	size_t c, pixel_count;
+
+	palette_init(layout->palette);
+	memset(transparency, 0, sizeof(transparency));
+	pixel_count = (size_t) img->width * img->height;
+	for (c = 0; c < pixel_count; c++) {
+		const uint8_t *pixel = img->pixels + 4*c;
+
+		if (count_colors) {
+			palette_add(layout->palette, pixel[0], pixel[1], pixel[2]);
+			count_colors = !palette_full(layout->palette);
+		}
+		if (!transparency[pixel[3]]) {
+			transparency[pixel[3]] = 1;
+			transparency_count++;
+			if (needs_transparency(transparency, transparency_count))
+				count_colors = false;
+		}
+	}
+	need_transparency = needs_transparency(transparency, transparency_count);
+
+	if (need_transparency) {
+		bit_count = 32;
+	} else if (palette_count(layout->palette) <= 256) {
+		for (bit_count = 1; palette_count(layout->palette) > 1U << bit_count; bit_count <<= 1);
+		if (bit_count == 2)	/* four colors (two bits) are not supported */
+			bit_count = 4;
+	} else {
+		bit_count = 24;
+	}
+
+	layout->bit_count = MAX(bit_count, supported_bit_count(img->bit_count));
+	layout->palette_count = (layout->bit_count <= 8 ? 1 << layout->bit_count : 0);
+	layout->image_size = img->height * ROW_BYTES(img->width * layout->bit_count);
+	layout->mask_size = img->height * ROW_BYTES(img->width);
+	layout->dib_size = BITMAP_HEADER_SIZE + layout->palette_count * 4
+			+ layout->image_size + layout->mask_size;
+}
+
+/* write_dib:
+ *   Write the bitmap header, palette, pixels and AND mask of an image.
+ *   The output must be zeroed.
+ */
+static void
+write_dib(const IcoImage *img, EncodeLayout *layout, uint8_t alpha_threshold, uint8_t *out)
+{
+	uint32_t image_row_size = layout->image_size / img->height;
+	uint32_t mask_row_size = layout->mask_size / img->height;
+	uint8_t *image_data, *mask_data;
+	uint8_t r, g, b;
+	uint32_t d, x;
+
+	put_le32(out, BITMAP_HEADER_SIZE);
+	put_le32(out + 4, img->width);
+	put_le32(out + 8, img->height * 2);
+	put_le16(out + 12, 1);
+	put_le16(out + 14, layout->bit_count);
+	put_le32(out + 20, layout->image_size);
+	put_le32(out + 32, layout->palette_count);
+	out += BITMAP_HEADER_SIZE;
+
+	/* Unused palette entries are left black, see write_dib in
+	 * icotool/create.c for why the palette is padded. */
+	if (layout->bit_count <= 8) {
+		for (d = 0; palette_next(layout->palette, &r, &g, &b); d++) {
+			out[4*d+0] = b;
+			out[4*d+1] = g;
+			out[4*d+2] = r;
+		}
+		out += layout->palette_count * 4;
+	}
+
+	image_data = out;
+	mask_data = out + layout->image_size;
+	for (d = 0; d < img->height; d++) {
+		const uint8_t *row = img->pixels + (size_t) d * img->width * 4;
+		uint32_t y = img->height - d - 1;
+		uint8_t *dst = image_data + y * image_row_size;
+
+		if (layout->bit_count <= 8) {
+			for (x = 0; x < img->width; x++) {
+				uint32_t index = palette_lookup(layout->palette, row[4*x+0], row[4*x+1], row[4*x+2]);
+				uint32_t bit = x * layout->bit_count;
+				dst[bit >> 3] |= index << (8 - layout->bit_count - (bit & 7));
+			}
+		} else {
+			dib_row_encoder(layout->bit_count)(row, dst, img->width);
+		}
+		dib_encode_mask_row(row, mask_data + y * mask_row_size, img->width, alpha_threshold);
+	}
+}
+
+/* ico_encode:
+ *   Encode images as an icon or cursor file. Each image is stored as
+ *   a DIB of the least bit depth that keeps all its colors and
+ *   transparency, but not less than its bit_count. Pixels with alpha
+ *   not above alpha_threshold are transparent in the AND mask. The
+ *   returned data should be freed with ico_data_free.
+ */
+IcoStatus
+ico_encode(const IcoFile *file, uint8_t alpha_threshold, const IcoAllocator *allocator, void **data, size_t *size)
+{
+	EncodeLayout *layouts;
+	uint8_t *palettes, *out;
+	uint64_t total;
+	uint32_t offset, c;
+
+	*data = NULL;
+	*size = 0;
+	if (file->count > UINT16_MAX)
+		return ICO_ERROR_UNSUPPORTED;
+
+	layouts = ico_alloc(allocator, file->count * sizeof(EncodeLayout) + 1);
+	palettes = ico_alloc(allocator, file->count * palette_size() + 1);
+	if (layouts == NULL || palettes == NULL) {
+		ico_free(allocator, layouts);
+		ico_free(allocator, palettes);
+		return ICO_ERROR_MEMORY;
+	}
+
+	total = ICO_HEADER_SIZE + (uint64_t) file->count * ICO_ENTRY_SIZE;
+	for (c = 0; c < file->count; c++) {
+		const IcoImage *img = &file->images[c];
+
+		/* keep the sizes in analyze_image within 32 bits */
+		if (img->width == 0 || img->height == 0 || img->width > INT32_MAX / 32
+		    || img->height > UINT32_MAX / 8 / img->width) {
+			ico_free(allocator, layouts);
+			ico_free(allocator, palettes);
+			return ICO_ERROR_UNSUPPORTED;
+		}
+		layouts[c].palette = (Palette *) (palettes + c * palette_size());
+		analyze_image(img, &layouts[c]);
+		total += layouts[c].dib_size;
+	}
+	if (total > UINT32_MAX || total > SIZE_MAX
+	    || (out = ico_alloc(allocator, total)) == NULL) {
+		ico_free(allocator, layouts);
+		ico_free(allocator, palettes);
+		return (total > UINT32_MAX ? ICO_ERROR_UNSUPPORTED : ICO_ERROR_MEMORY);
+	}
+	memset(out, 0, total);
+
+	put_le16(out + 2, file->cursor ? 2 : 1);
+	put_le16(out + 4, file->count);
+	offset = ICO_HEADER_SIZE + file->count * ICO_ENTRY_SIZE;
+	for (c = 0; c < file->count; c++) {
+		const IcoImage *img = &file->images[c];
+		uint8_t *entry = out + ICO_HEADER_SIZE + c * ICO_ENTRY_SIZE;
+
+		/* dimensions of 256 and more are stored as 0 */
+		if (img->width < 256 && img->height < 256) {
+			entry[0] = img->width;
+			entry[1] = img->height;
+		}
+		entry[2] = (layouts[c].bit_count >= 8 ? 0 : 1 << layouts[c].bit_count);
+		if (file->cursor) {
+			put_le16(entry + 4, img->hotspot_x);
+			put_le16(entry + 6, img->hotspot_y);
+		} else {
+			put_le16(entry + 4, 1);
+			put_le16(entry + 6, layouts[c].bit_count);
+		}
+		put_le32(entry + 8, layouts[c].dib_size);
+		put_le32(entry + 12, offset);
+
+		write_dib(img, &layouts[c], alpha_threshold, out + offset);
+		offset += layouts[c].dib_size;
+	}
+
+	ico_free(allocator, layouts);
+	ico_free(allocator, palettes);
+	*data = out;
+	*size = total;
+	return ICO_OK;
+}
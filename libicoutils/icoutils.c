@@ -0,0 +1,99 @@
+/* icoutils.c - Memory management and error messages for libicoutils
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>		/* C89 */
+#include "icotool/icotool.h"
+#include "private.h"
+
+void *
+ico_alloc(const IcoAllocator *allocator, size_t size)
+{
+	if (allocator == NULL)
+		return malloc(size);
+	return allocator->alloc(size, allocator->data);
+}
+
+void
+ico_free(const IcoAllocator *allocator, void *ptr)
+{
+	if (ptr == NULL)
+		return;
+	if (allocator == NULL)
+		free(ptr);
+	else
+		allocator->free(ptr, allocator->data);
+}
+
+/* ico_strerror:
+ *   Return a message describing a status code. The messages are
+ *   not translated.
+ */
+const char *
+ico_strerror(IcoStatus status)
+{
+	switch (status) {
+	case ICO_OK:
+		return "success";
+	case ICO_ERROR_MEMORY:
+		return "out of memory";
+	case ICO_ERROR_FORMAT:
+		return "invalid or corrupt file";
+	case ICO_ERROR_TRUNCATED:
+		return "premature end";
+	case ICO_ERROR_UNSUPPORTED:
+		return "unsupported file";
+	}
+	return "unknown error";
+}
+
+/* ico_file_free:
+ *   Free the images of a file returned by ico_decode. The IcoFile
+ *   structure itself belongs to the caller.
+ */
+void
+ico_file_free(IcoFile *file, const IcoAllocator *allocator)
+{
+	uint32_t c;
+
+	for (c = 0; c < file->count; c++)
+		ico_free(allocator, file->images[c].pixels);
+	ico_free(allocator, file->images);
+	file->images = NULL;
+	file->count = 0;
+}
+
+/* ico_data_free:
+ *   Free a memory block returned by ico_encode.
+ */
+void
+ico_data_free(void *data, const IcoAllocator *allocator)
+{
+	ico_free(allocator, data);
+}
+
+/* ico_portable_fallback:
+ *   Return true if optimized pixel conversion code for this processor
+ *   failed its self test, and slower portable code is used instead.
+ *   Output is the same either way.
+ */
+bool
+ico_portable_fallback(void)
+{
+	return dib_kernels_fallback();
+}
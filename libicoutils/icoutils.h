@@ -0,0 +1,96 @@
+/* icoutils.h - In-memory icon, cursor and resource library
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ICOUTILS_H
+#define ICOUTILS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* All functions work on memory blocks supplied by the caller. They
+ * print nothing and never exit; errors are returned as an IcoStatus.
+ * The only state kept between calls is the choice of pixel conversion
+ * code for the processor, made once per process on first use and safe
+ * to make from several threads (see ico_portable_fallback). */
+
+typedef enum {
+	ICO_OK = 0,
+	ICO_ERROR_MEMORY,	/* the allocator failed */
+	ICO_ERROR_FORMAT,	/* not an icon, cursor or PE file, or corrupt */
+	ICO_ERROR_TRUNCATED,	/* data ends prematurely */
+	ICO_ERROR_UNSUPPORTED,	/* valid but unsupported (compressed DIB, NE file) */
+} IcoStatus;
+
+/* Memory allocated by the library, and memory it returns to the
+ * caller, is obtained through an IcoAllocator. A NULL allocator
+ * means malloc and free. */
+typedef struct {
+	void *(*alloc)(size_t size, void *data);
+	void (*free)(void *ptr, void *data);
+	void *data;
+} IcoAllocator;
+
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	uint32_t bit_count;	/* bit depth as stored, 0 when encoding picks one */
+	uint32_t palette_size;
+	uint16_t hotspot_x;	/* cursors only */
+	uint16_t hotspot_y;
+	bool png;		/* image was stored as PNG */
+	uint8_t *pixels;	/* width * height RGBA pixels, top row first */
+} IcoImage;
+
+typedef struct {
+	bool cursor;
+	uint32_t count;
+	IcoImage *images;
+} IcoFile;
+
+/* A resource, identified either by a numeric id or by a name. */
+typedef struct {
+	uint32_t id;		/* 0 if the resource is named */
+	const char *name;	/* NULL if the resource has a numeric id */
+	uint16_t language;
+} IcoResource;
+
+/* Called with a complete .ico or .cur file for each group_icon or
+ * group_cursor resource. The data is only valid during the call.
+ * Return false to stop. */
+typedef bool (*IcoResourceCallback)(const IcoResource *resource, const void *data, size_t size, void *user_data);
+
+const char *ico_strerror(IcoStatus status);
+
+IcoStatus ico_decode(const void *data, size_t size, const IcoAllocator *allocator, IcoFile *file);
+IcoStatus ico_encode(const IcoFile *file, uint8_t alpha_threshold, const IcoAllocator *allocator, void **data, size_t *size);
+void ico_file_free(IcoFile *file, const IcoAllocator *allocator);
+void ico_data_free(void *data, const IcoAllocator *allocator);
+bool ico_portable_fallback(void);
+
+IcoStatus ico_extract_groups(const void *binary, size_t size, bool cursors, const IcoAllocator *allocator, IcoResourceCallback callback, void *user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+/* private.h - Definitions shared by the libicoutils sources
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBICOUTILS_PRIVATE_H
+#define LIBICOUTILS_PRIVATE_H
+
+#include "icoutils.h"
+
+#define ICO_HEADER_SIZE		6
+#define ICO_ENTRY_SIZE		16
+#define BITMAP_HEADER_SIZE	40
+
+#define ROW_BYTES(bits) ((((bits) + 31) >> 5) << 2)
+
+/* icoutils.c */
+void *ico_alloc(const IcoAllocator *allocator, size_t size);
+void ico_free(const IcoAllocator *allocator, void *ptr);
+
+/* Fields are read and written as little endian bytes, so that no
+ * structure layout or host byte order is assumed. */
+static inline uint16_t
+get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t
+get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline void
+put_le16(uint8_t *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static inline void
+put_le32(uint8_t *p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+#endif
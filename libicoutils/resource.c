@@ -0,0 +1,399 @@
+/* resource.c - Extract icon and cursor resources from PE files in memory
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <string.h>		/* C89 */
+#include "minmax.h"		/* Gnulib */
+#include "private.h"
+
+#define RT_CURSOR		1
+#define RT_ICON			3
+#define RT_GROUP_CURSOR		12
+#define RT_GROUP_ICON		14
+
+#define PE_OPTIONAL_MAGIC_32	0x10b
+#define PE_OPTIONAL_MAGIC_64	0x20b
+#define PE_RESOURCE_DIRECTORY	2
+#define PE_SECTION_HEADER_SIZE	40
+#define GROUP_ENTRY_SIZE	14
+
+/* The longest resource name reported; like wrestool, only the low
+ * byte of each UTF-16 character is kept. */
+#define RESOURCE_NAME_MAX	256
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	const uint8_t *sections;
+	uint32_t section_count;
+	size_t root;		/* file offset of the root resource directory */
+	size_t root_size;
+} PEImage;
+
+/* rva_to_offset:
+ *   Map an address in the loaded image to a file offset, checking
+ *   that size bytes are in the file. Returns false if they are not.
+ */
+static bool
+rva_to_offset(const PEImage *pe, uint32_t rva, uint32_t size, size_t *offset)
+{
+	uint32_t c;
+
+	for (c = 0; c < pe->section_count; c++) {
+		const uint8_t *section = pe->sections + c * PE_SECTION_HEADER_SIZE;
+		uint32_t virtual_size = get_le32(section + 8);
+		uint32_t virtual_address = get_le32(section + 12);
+		uint32_t raw_size = get_le32(section + 16);
+		uint32_t raw_offset = get_le32(section + 20);
+
+		if (virtual_size == 0)
+			virtual_size = raw_size;
+		if (rva >= virtual_address && rva - virtual_address < virtual_size) {
+			uint64_t start = (uint64_t) raw_offset + (rva - virtual_address);
+
+			if (start + size > pe->size)
+				return false;
+			*offset = start;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* open_pe:
+ *   Locate the section table and resource directory of a PE file.
+ */
+static IcoStatus
+open_pe(const uint8_t *data, size_t size, PEImage *pe)
+{
+	uint32_t header, optional_size, directory_count;
+	size_t optional, directories;
+	uint32_t resource_rva, resource_size;
+
+	pe->data = data;
+	pe->size = size;
+	if (size < 64)
+		return ICO_ERROR_FORMAT;
+	if (data[0] != 'M' || data[1] != 'Z')
+		return ICO_ERROR_FORMAT;
+	header = get_le32(data + 60);
+	if (header > size - 4)
+		return ICO_ERROR_FORMAT;
+	if (memcmp(data + header, "NE", 2) == 0)
+		return ICO_ERROR_UNSUPPORTED;
+	if (memcmp(data + header, "PE\0\0", 4) != 0)
+		return ICO_ERROR_FORMAT;
+	if ((uint64_t) header + 24 > size)
+		return ICO_ERROR_TRUNCATED;
+
+	pe->section_count = get_le16(data + header + 6);
+	optional_size = get_le16(data + header + 20);
+	optional = header + 24;
+	if (optional + optional_size > size || optional_size < 2)
+		return ICO_ERROR_TRUNCATED;
+	switch (get_le16(data + optional)) {
+	case PE_OPTIONAL_MAGIC_32:
+		directories = 96;
+		break;
+	case PE_OPTIONAL_MAGIC_64:
+		directories = 112;
+		break;
+	default:
+		return ICO_ERROR_FORMAT;
+	}
+	if (directories > optional_size)
+		return ICO_ERROR_FORMAT;
+	directory_count = get_le32(data + optional + directories - 4);
+	if (directory_count <= PE_RESOURCE_DIRECTORY
+	    || directories + (PE_RESOURCE_DIRECTORY + 1) * 8 > optional_size)
+		return ICO_ERROR_FORMAT;
+
+	pe->sections = data + optional + optional_size;
+	if ((uint64_t) pe->section_count * PE_SECTION_HEADER_SIZE > size - (optional + optional_size))
+		return ICO_ERROR_TRUNCATED;
+
+	resource_rva = get_le32(data + optional + directories + PE_RESOURCE_DIRECTORY * 8);
+	resource_size = get_le32(data + optional + directories + PE_RESOURCE_DIRECTORY * 8 + 4);
+	pe->root_size = 0;
+	if (resource_rva == 0)
+		return ICO_OK;	/* no resources */
+	if (!rva_to_offset(pe, resource_rva, 16, &pe->root))
+		return ICO_ERROR_TRUNCATED;
+	pe->root_size = MIN(resource_size, size - pe->root);
+	return ICO_OK;
+}
+
+/* directory_entries:
+ *   Return the file offset of the entries of a resource directory at
+ *   an offset relative to the root, or 0 if they are outside the
+ *   resources. *count is set to the number of entries.
+ */
+static size_t
+directory_entries(const PEImage *pe, uint32_t directory, uint32_t *count)
+{
+	const uint8_t *dir;
+
+	if ((uint64_t) directory + 16 > pe->root_size)
+		return 0;
+	dir = pe->data + pe->root + directory;
+	*count = get_le16(dir + 12) + get_le16(dir + 14);
+	if ((uint64_t) directory + 16 + (uint64_t) *count * 8 > pe->root_size)
+		return 0;
+	return pe->root + directory + 16;
+}
+
+/* find_entry:
+ *   Find the subdirectory or data entry with a numeric id in a resource
+ *   directory. Returns the offset relative to the root, with the
+ *   subdirectory bit set for directories, or 0 if there is no such
+ *   entry.
+ */
+static uint32_t
+find_entry(const PEImage *pe, uint32_t directory, uint32_t id)
+{
+	uint32_t count, c;
+	size_t entries = directory_entries(pe, directory, &count);
+
+	if (entries == 0)
+		return 0;
+	for (c = 0; c < count; c++) {
+		const uint8_t *entry = pe->data + entries + c * 8;
+		uint32_t name = get_le32(entry);
+
+		if (!(name & 0x80000000) && name == id)
+			return get_le32(entry + 4);
+	}
+	return 0;
+}
+
+/* get_data:
+ *   Return the file offset and size of the data of a resource data
+ *   entry, or false if it is invalid.
+ */
+static bool
+get_data(const PEImage *pe, uint32_t entry, size_t *offset, uint32_t *size)
+{
+	const uint8_t *data_entry;
+
+	if ((entry & 0x80000000) || (uint64_t) entry + 16 > pe->root_size)
+		return false;
+	data_entry = pe->data + pe->root + entry;
+	*size = get_le32(data_entry + 4);
+	return rva_to_offset(pe, get_le32(data_entry), *size, offset);
+}
+
+/* find_image:
+ *   Find the icon or cursor resource with the specified id and
+ *   language.
+ */
+static bool
+find_image(const PEImage *pe, uint32_t type, uint32_t id, uint16_t language, size_t *offset, uint32_t *size)
+{
+	uint32_t entry;
+
+	entry = find_entry(pe, 0, type);
+	if (!(entry & 0x80000000))
+		return false;
+	entry = find_entry(pe, entry & 0x7FFFFFFF, id);
+	if (!(entry & 0x80000000))
+		return false;
+	entry = find_entry(pe, entry & 0x7FFFFFFF, language);
+	return entry != 0 && get_data(pe, entry, offset, size);
+}
+
+/* assemble_group:
+ *   Make an icon or cursor file from a group resource and the icon or
+ *   cursor resources it refers to, the way wrestool does. Empty images
+ *   are left out. The file is allocated with the caller's allocator;
+ *   returns NULL in *file if an image is missing.
+ */
+static IcoStatus
+assemble_group(const PEImage *pe, bool cursors, const uint8_t *group, uint32_t group_size, uint16_t language,
+	       const IcoAllocator *allocator, uint8_t **file, size_t *file_size)
+{
+	uint32_t prefix = (cursors ? 4 : 0);
+	uint32_t count, used, offset, c;
+	uint64_t total;
+	uint8_t *out;
+
+	*file = NULL;
+	if (group_size < ICO_HEADER_SIZE)
+		return ICO_OK;
+	count = get_le16(group + 4);
+	if (ICO_HEADER_SIZE + (uint64_t) count * GROUP_ENTRY_SIZE > group_size)
+		return ICO_OK;
+
+	used = 0;
+	total = 0;
+	for (c = 0; c < count; c++) {
+		const uint8_t *entry = group + ICO_HEADER_SIZE + c * GROUP_ENTRY_SIZE;
+		size_t data_offset;
+		uint32_t size;
+
+		if (!find_image(pe, cursors ? RT_CURSOR : RT_ICON, get_le16(entry + 12), language, &data_offset, &size))
+			return ICO_OK;
+		if (size <= prefix)
+			continue;
+		used++;
+		total += size - prefix;
+	}
+	total += ICO_HEADER_SIZE + (uint64_t) used * ICO_ENTRY_SIZE;
+	if (total > UINT32_MAX || total > SIZE_MAX)
+		return ICO_OK;
+
+	out = ico_alloc(allocator, total);
+	if (out == NULL)
+		return ICO_ERROR_MEMORY;
+	memset(out, 0, ICO_HEADER_SIZE);
+	put_le16(out + 2, cursors ? 2 : 1);
+	put_le16(out + 4, used);
+
+	offset = ICO_HEADER_SIZE + used * ICO_ENTRY_SIZE;
+	used = 0;
+	for (c = 0; c < count; c++) {
+		const uint8_t *entry = group + ICO_HEADER_SIZE + c * GROUP_ENTRY_SIZE;
+		uint8_t *file_entry = out + ICO_HEADER_SIZE + used * ICO_ENTRY_SIZE;
+		const uint8_t *data;
+		size_t data_offset;
+		uint32_t size;
+
+		/* found in the first pass */
+		if (!find_image(pe, cursors ? RT_CURSOR : RT_ICON, get_le16(entry + 12), language, &data_offset, &size)
+		    || size <= prefix)
+			continue;
+		data = pe->data + data_offset;
+
+		if (cursors) {
+			/* width and height are words, height is doubled, and
+			 * the image starts with the hotspot */
+			file_entry[0] = get_le16(entry);
+			file_entry[1] = get_le16(entry + 2) / 2;
+			file_entry[2] = 0;
+			file_entry[3] = 0;
+			memcpy(file_entry + 4, data, 4);
+		} else {
+			memcpy(file_entry, entry, 8);
+		}
+		put_le32(file_entry + 8, size - prefix);
+		put_le32(file_entry + 12, offset);
+		memcpy(out + offset, data + prefix, size - prefix);
+		offset += size - prefix;
+		used++;
+	}
+
+	*file = out;
+	*file_size = total;
+	return ICO_OK;
+}
+
+/* get_name:
+ *   Describe the name or id of a resource directory entry.
+ */
+static void
+get_name(const PEImage *pe, const uint8_t *entry, IcoResource *resource, char *name)
+{
+	uint32_t value = get_le32(entry);
+
+	resource->id = 0;
+	resource->name = NULL;
+	if (value & 0x80000000) {
+		uint64_t offset = value & 0x7FFFFFFF;
+		uint32_t length, c;
+
+		name[0] = '\0';
+		resource->name = name;
+		if (offset + 2 > pe->root_size)
+			return;
+		length = get_le16(pe->data + pe->root + offset);
+		length = MIN(length, RESOURCE_NAME_MAX - 1);
+		if (offset + 2 + length * 2 > pe->root_size)
+			return;
+		for (c = 0; c < length; c++)
+			name[c] = pe->data[pe->root + offset + 2 + c * 2];
+		name[length] = '\0';
+	} else {
+		resource->id = value;
+	}
+}
+
+/* ico_extract_groups:
+ *   Call callback with an icon file for each group_icon resource of a
+ *   PE file, or a cursor file for each group_cursor resource. Groups
+ *   that refer to missing images are skipped. NE files are not
+ *   supported.
+ */
+IcoStatus
+ico_extract_groups(const void *binary, size_t size, bool cursors, const IcoAllocator *allocator, IcoResourceCallback callback, void *user_data)
+{
+	PEImage pe;
+	IcoStatus status;
+	uint32_t type, name_count, c;
+	size_t names;
+
+	status = open_pe(binary, size, &pe);
+	if (status != ICO_OK || pe.root_size == 0)
+		return status;
+
+	type = find_entry(&pe, 0, cursors ? RT_GROUP_CURSOR : RT_GROUP_ICON);
+	if (!(type & 0x80000000))
+		return ICO_OK;
+	names = directory_entries(&pe, type & 0x7FFFFFFF, &name_count);
+	if (names == 0)
+		return ICO_ERROR_FORMAT;
+
+	for (c = 0; c < name_count; c++) {
+		const uint8_t *name_entry = pe.data + names + c * 8;
+		uint32_t languages = get_le32(name_entry + 4);
+		uint32_t language_count, d;
+		size_t language_entries;
+		char name[RESOURCE_NAME_MAX];
+		IcoResource resource;
+
+		if (!(languages & 0x80000000))
+			continue;
+		language_entries = directory_entries(&pe, languages & 0x7FFFFFFF, &language_count);
+		if (language_entries == 0)
+			continue;
+		get_name(&pe, name_entry, &resource, name);
+
+		for (d = 0; d < language_count; d++) {
+			const uint8_t *language_entry = pe.data + language_entries + d * 8;
+			size_t group_offset, file_size;
+			uint32_t group_size;
+			uint8_t *file;
+			bool more;
+
+			if (!get_data(&pe, get_le32(language_entry + 4), &group_offset, &group_size))
+				continue;
+			resource.language = get_le32(language_entry);
+			status = assemble_group(&pe, cursors, pe.data + group_offset, group_size, resource.language,
+						allocator, &file, &file_size);
+			if (status != ICO_OK)
+				return status;
+			if (file == NULL)
+				continue;
+			more = callback(&resource, file, file_size, user_data);
+			ico_free(allocator, file);
+			if (!more)
+				return ICO_OK;
+		}
+	}
+
+	return ICO_OK;
+}
@@ -0,0 +1,341 @@
+/* icoutils-test.c - Tests of the libicoutils functions
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Usage: icoutils-test GROUP-ICON.EXE
+ *
+ * All memory used by the library comes from a counting allocator,
+ * which hands out blocks of a static arena, so that the test can
+ * check that everything is freed, also when an allocation fails. */
+
+#include <config.h>
+#include <stdbool.h>		/* POSIX/Gnulib */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <stdio.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include "icoutils.h"
+
+#define ARENA_SIZE	(8 * 1024 * 1024)
+#define FIXTURE_MAX	(64 * 1024)
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+typedef struct {
+	size_t used;
+	uint32_t live;		/* blocks allocated and not yet freed */
+	uint32_t allocations;
+	int32_t fail_after;	/* allocations to allow, or -1 for any */
+} Counter;
+
+static int failures = 0;
+static uint8_t arena[ARENA_SIZE];
+
+/* Set while the library is called. On glibc systems malloc and
+ * friends are replaced to catch allocations outside the allocator,
+ * unless a sanitizer has replaced them already. */
+static bool watching = false;
+static uint32_t stray_allocations = 0;
+
+#if defined __has_feature
+# if __has_feature(address_sanitizer)
+#  define __SANITIZE_ADDRESS__ 1
+# endif
+#endif
+
+#if defined __GLIBC__ && !defined __SANITIZE_ADDRESS__
+/* not the Gnulib replacements, if any */
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *
+malloc(size_t size)
+{
+	stray_allocations += watching;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t count, size_t size)
+{
+	stray_allocations += watching;
+	return __libc_calloc(count, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	stray_allocations += watching;
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+static void *
+counting_alloc(size_t size, void *data)
+{
+	Counter *counter = data;
+	void *ptr;
+
+	if (counter->fail_after >= 0 && counter->allocations >= (uint32_t) counter->fail_after)
+		return NULL;
+	if (size > ARENA_SIZE - counter->used)
+		return NULL;
+	ptr = arena + counter->used;
+	counter->used += (size + 15) & ~(size_t) 15;
+	counter->allocations++;
+	counter->live++;
+	return ptr;
+}
+
+static void
+counting_free(void *ptr, void *data)
+{
+	Counter *counter = data;
+
+	CHECK((uint8_t *) ptr >= arena && (uint8_t *) ptr < arena + counter->used);
+	CHECK(counter->live > 0);
+	counter->live--;
+}
+
+/* reset_counter:
+ *   Start counting again, reusing the whole arena. Every block must
+ *   have been freed.
+ */
+static void
+reset_counter(Counter *counter, int32_t fail_after)
+{
+	counter->used = 0;
+	counter->live = 0;
+	counter->allocations = 0;
+	counter->fail_after = fail_after;
+}
+
+/* test_round_trip:
+ *   Encode a paletted and an alpha-blended image, and check that
+ *   they decode to the same pixels.
+ */
+static void
+test_round_trip(bool cursor)
+{
+	static uint8_t paletted[16 * 16 * 4];
+	static uint8_t blended[24 * 24 * 4];
+	IcoImage images[2];
+	IcoFile file = { cursor, 2, images }, decoded;
+	Counter counter;
+	IcoAllocator allocator = { counting_alloc, counting_free, &counter };
+	void *data;
+	size_t size;
+	uint32_t c;
+
+	for (c = 0; c < 16 * 16; c++) {
+		static const uint8_t colors[3][4] = { { 255, 0, 0, 255 }, { 0, 128, 0, 255 }, { 10, 20, 30, 255 } };
+		memcpy(paletted + 4*c, colors[c % 3], 4);
+	}
+	for (c = 0; c < 24 * 24; c++) {
+		blended[4*c+0] = c;
+		blended[4*c+1] = c >> 2;
+		blended[4*c+2] = 255 - c;
+		blended[4*c+3] = c * 7;
+	}
+	memset(images, 0, sizeof(images));
+	images[0].width = images[0].height = 16;
+	images[0].pixels = paletted;
+	images[0].hotspot_x = 3;
+	images[0].hotspot_y = 5;
+	images[1].width = images[1].height = 24;
+	images[1].pixels = blended;
+
+	reset_counter(&counter, -1);
+	CHECK(ico_encode(&file, 127, &allocator, &data, &size) == ICO_OK);
+	CHECK(counter.live == 1);
+	CHECK(ico_decode(data, size, &allocator, &decoded) == ICO_OK);
+	CHECK(decoded.cursor == cursor);
+	CHECK(decoded.count == 2);
+	if (decoded.count == 2) {
+		CHECK(decoded.images[0].width == 16 && decoded.images[0].height == 16);
+		CHECK(decoded.images[0].bit_count == 4 && decoded.images[0].palette_size == 16);
+		CHECK(memcmp(decoded.images[0].pixels, paletted, sizeof(paletted)) == 0);
+		CHECK(decoded.images[1].width == 24 && decoded.images[1].height == 24);
+		CHECK(decoded.images[1].bit_count == 32);
+		CHECK(memcmp(decoded.images[1].pixels, blended, sizeof(blended)) == 0);
+		if (cursor)
+			CHECK(decoded.images[0].hotspot_x == 3 && decoded.images[0].hotspot_y == 5);
+	}
+
+	/* A file cut short must not be read past its end. The AND mask
+	 * of 32-bit images is not needed, so cut into the pixels. */
+	ico_file_free(&decoded, &allocator);
+	CHECK(ico_decode(data, size / 2, &allocator, &decoded) == ICO_ERROR_TRUNCATED);
+	CHECK(ico_decode(data, 20, &allocator, &decoded) == ICO_ERROR_TRUNCATED);
+	CHECK(ico_decode(data, 3, &allocator, &decoded) == ICO_ERROR_TRUNCATED);
+	ico_data_free(data, &allocator);
+	CHECK(counter.live == 0);
+}
+
+/* check_group_icon:
+ *   Check the icon file assembled from the group of the fixture: a
+ *   32-bit bitmap and a PNG image.
+ */
+static void
+check_group_icon(const uint8_t *data, size_t size)
+{
+	Counter counter;
+	IcoAllocator allocator = { counting_alloc, counting_free, &counter };
+	IcoFile file;
+	uint32_t x, y;
+	int32_t fail_after;
+	IcoStatus status;
+
+	reset_counter(&counter, -1);
+	CHECK(ico_decode(data, size, &allocator, &file) == ICO_OK);
+	CHECK(file.count == 2);
+	if (file.count == 2) {
+		const IcoImage *dib = &file.images[0], *png = &file.images[1];
+
+		CHECK(!dib->png && dib->width == 16 && dib->height == 16 && dib->bit_count == 32);
+		for (y = 0; y < 16; y++) {
+			for (x = 0; x < 16; x++) {
+				const uint8_t *p = dib->pixels + 4 * (y * 16 + x);
+				CHECK(p[0] == x * 16 && p[1] == y * 16 && p[2] == 0x40 && p[3] == x * 16 + y);
+			}
+		}
+		CHECK(png->png && png->width == 32 && png->height == 32);
+		for (y = 0; y < 32; y++) {
+			for (x = 0; x < 32; x++) {
+				const uint8_t *p = png->pixels + 4 * (y * 32 + x);
+				int dx = x - 16, dy = y - 16;
+				uint8_t alpha = (dx * dx + dy * dy > 225 ? 0 : 255);
+				CHECK(p[0] == x * 8 && p[1] == y * 8 && p[2] == 128 && p[3] == alpha);
+			}
+		}
+	}
+	ico_file_free(&file, &allocator);
+	CHECK(counter.live == 0);
+	CHECK(counter.allocations > 3);	/* the libpng structures too */
+
+	/* the PNG image ends with the file */
+	reset_counter(&counter, -1);
+	CHECK(ico_decode(data, size - 16, &allocator, &file) == ICO_ERROR_TRUNCATED);
+	CHECK(counter.live == 0);
+
+	/* every allocation that can fail is cleaned up after */
+	for (fail_after = 0; fail_after < 1000; fail_after++) {
+		reset_counter(&counter, fail_after);
+		status = ico_decode(data, size, &allocator, &file);
+		if (status == ICO_OK) {
+			ico_file_free(&file, &allocator);
+			CHECK(counter.live == 0);
+			break;
+		}
+		CHECK(status == ICO_ERROR_MEMORY);
+		CHECK(counter.live == 0);
+		if (status != ICO_ERROR_MEMORY)
+			break;
+	}
+}
+
+typedef struct {
+	uint32_t groups;
+} GroupResult;
+
+static bool
+group_callback(const IcoResource *resource, const void *data, size_t size, void *user_data)
+{
+	/* the data is in the arena, which check_group_icon reuses */
+	static uint8_t copy[FIXTURE_MAX];
+	GroupResult *result = user_data;
+
+	result->groups++;
+	CHECK(resource->id == 1 && resource->name == NULL && resource->language == 1033);
+	CHECK(size <= sizeof(copy));
+	if (size <= sizeof(copy)) {
+		memcpy(copy, data, size);
+		check_group_icon(copy, size);
+	}
+	return true;
+}
+
+/* test_extract_groups:
+ *   Extract the single group of icons of the fixture.
+ */
+static void
+test_extract_groups(const uint8_t *binary, size_t size)
+{
+	Counter counter;
+	IcoAllocator allocator = { counting_alloc, counting_free, &counter };
+	GroupResult result = { 0 };
+
+	reset_counter(&counter, -1);
+	CHECK(ico_extract_groups(binary, size, false, &allocator, group_callback, &result) == ICO_OK);
+	CHECK(result.groups == 1);
+	CHECK(counter.live == 0);
+
+	result.groups = 0;
+	CHECK(ico_extract_groups(binary, size, true, &allocator, group_callback, &result) == ICO_OK);
+	CHECK(result.groups == 0);
+	CHECK(ico_extract_groups(binary, 100, false, &allocator, group_callback, &result) == ICO_ERROR_TRUNCATED);
+	CHECK(ico_extract_groups(binary, 2, false, &allocator, group_callback, &result) == ICO_ERROR_FORMAT);
+	CHECK(result.groups == 0);
+	CHECK(counter.live == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	static uint8_t binary[FIXTURE_MAX];
+	size_t size;
+	FILE *in;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s GROUP-ICON.EXE\n", argv[0]);
+		return 1;
+	}
+	in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	size = fread(binary, 1, sizeof(binary), in);
+	fclose(in);
+
+	watching = true;
+	test_round_trip(false);
+	test_round_trip(true);
+	test_extract_groups(binary, size);
+	watching = false;
+
+	CHECK(stray_allocations == 0);
+	return failures > 0;
+}
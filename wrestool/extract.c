@@ -17,40 +17,77 @@
  */
 
 #include <config.h>
+#include <errno.h>			/* C89 */
+#if HAVE_WRITEV
+#include <sys/uio.h>			/* POSIX */
+#endif
+#if defined __linux__
+#include <sys/sendfile.h>		/* Linux */
+#endif
+#include <unistd.h>			/* POSIX */
 #include "gettext.h"			/* Gnulib */
 #define _(s) gettext(s)
 #define N_(s) gettext_noop(s)
 #include "xalloc.h"			/* Gnulib */
+#include "xvasprintf.h"			/* Gnulib */
+#include "minmax.h"			/* Gnulib */
 #include "common/error.h"
 #include "common/intutil.h"
+#include "common/string-utils.h"
 #include "win32.h"
 #include "win32-endian.h"
+#include "icotool.h"
 #include "fileread.h"
 #include "wrestool.h"
 
-static void *extract_group_icon_cursor_resource(WinLibrary *, WinResource *, char *, int *, bool);
-static void *extract_bitmap_resource(WinLibrary *, WinResource *, int *);
+/* parts written with a single call of writev */
+#define WRITE_PARTS_MAX		64
 
-void
+/* library parts of at least this size are copied by the kernel */
+#define KERNEL_COPY_MIN		(64 * 1024)
+
+#if defined __linux__ && defined __GLIBC__ \
+    && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define USE_COPY_FILE_RANGE 1
+#endif
+#if defined __linux__
+#define USE_SENDFILE 1
+#endif
+
+static bool extract_group_icon_cursor_resource(WinLibrary *, WinResource *, WinResource *, ExtractedResource *, bool);
+static bool extract_bitmap_resource(WinLibrary *, WinResource *, ExtractedResource *);
+static bool convert_group_icon_cursor(WinLibrary *fi, void *memory, size_t size, char *outname);
+
+bool
 extract_resources_callback (WinLibrary *fi, WinResource *wr,
                             WinResource *type_wr, WinResource *name_wr,
                             WinResource *lang_wr)
 {
-	int size;
-	bool free_it;
-	void *memory;
+	ExtractedResource res;
+	bool success = false;
 	char *outname;
 	FILE *out;
 
-	memory = extract_resource(fi, wr, &size, &free_it, type_wr->id, (lang_wr == NULL ? NULL : lang_wr->id), arg_raw);
-	free_it = false;
-	if (memory == NULL) {
+	if (!extract_resource(fi, wr, type_wr, lang_wr, arg_raw, &res)) {
 		/* extract resource has printed error */
-		return;
+		return false;
 	}
 
 	/* determine where to extract to */
 	outname = get_destination_name(fi, type_wr->id, name_wr->id, (lang_wr == NULL ? NULL : lang_wr->id));
+
+	/* write the images of icons and cursors as PNG files */
+	if (arg_convert && !arg_raw && is_group_icon_cursor_type(type_wr)) {
+		bool free_it;
+		void *memory = extracted_resource_data(&res, &free_it);
+
+		out = NULL;
+		success = convert_group_icon_cursor(fi, memory, res.size, outname);
+		if (free_it)
+			free(memory);
+		goto cleanup;
+	}
+
 	if (outname == NULL) {
 		out = stdout;
 	} else {
@@ -62,91 +99,310 @@ extract_resources_callback (WinLibrary *fi, WinResource *wr,
 	}
 
 	/* write the actual data */
-	fwrite(memory, size, 1, out);
+	if (!write_extracted_resource(fi, &res, out))
+		warn_errno("%s", (outname == NULL ? _("(standard out)") : outname));
+	else
+		success = true;
 	
 	cleanup:
-	if (free_it)
-		free(memory);
+	free_extracted_resource(&res);
 	if (out != NULL && out != stdout)
 		fclose(out);
+	return success;
+}
+
+/* is_group_icon_cursor_type:
+ *   Return true if resources of the specified type are extracted as
+ *   icon or cursor files.
+ */
+bool
+is_group_icon_cursor_type(WinResource *type)
+{
+	return type->numeric_id
+	    && (type->value == (int) RT_GROUP_ICON || type->value == (int) RT_GROUP_CURSOR);
+}
+
+static bool
+convert_filter(UNUSED int index, UNUSED int width, UNUSED int height, UNUSED int bitdepth, UNUSED int palettesize, UNUSED bool icon, UNUSED int hotspot_x, UNUSED int hotspot_y)
+{
+	return true;
+}
+
+/* convert_outfile_gen:
+ *   Make the name of a PNG file from that of the icon or cursor file
+ *   it would otherwise have been written to, the same way as
+ *   `icotool -x' does.
+ */
+static FILE *
+convert_outfile_gen(char **outname_ptr, int width, int height, int bit_count, int index)
+{
+	char *inname = *outname_ptr;
+	int len = strlen(inname);
+
+	if (ends_with_nocase(inname, ".ico") || ends_with_nocase(inname, ".cur"))
+		len -= 4;
+	*outname_ptr = xasprintf("%.*s_%d_%dx%dx%d.png", len, inname, index, width, height, bit_count);
+	return fopen(*outname_ptr, "wb");
+}
+
+static FILE *
+convert_stdout_gen(char **outname_ptr, UNUSED int width, UNUSED int height, UNUSED int bit_count, UNUSED int index)
+{
+	*outname_ptr = xstrdup(_("(standard out)"));
+	return stdout;
+}
+
+/* convert_group_icon_cursor:
+ *   Write the images of an icon or cursor file assembled in memory
+ *   as PNG files, or to standard out if outname is NULL. Returns
+ *   false if an error occured (it has then been printed).
+ */
+static bool
+convert_group_icon_cursor(WinLibrary *fi, void *memory, size_t size, char *outname)
+{
+	if (outname == NULL)
+		return extract_icons_from_memory(memory, size, fi->name, false, convert_stdout_gen, convert_filter, 1) != -1;
+	return extract_icons_from_memory(memory, size, outname, false, convert_outfile_gen, convert_filter, 1) != -1;
 }
 
 /* extract_resource:
- *   Extract a resource, returning pointer to data.
+ *   Extract a resource into res, which should be freed with
+ *   free_extracted_resource once used. Icons and cursors of a group
+ *   are looked up in the language of lang, if not NULL. Returns false
+ *   if an error occured (it has then been printed).
  */
-void *
-extract_resource (WinLibrary *fi, WinResource *wr, int *size,
-                  bool *free_it, char *type, char *lang, bool raw)
+bool
+extract_resource (WinLibrary *fi, WinResource *wr, WinResource *type,
+                  WinResource *lang, bool raw, ExtractedResource *res)
 {
-	char *str;
-	int32_t intval;
-	
-	/* just return pointer to data if raw */
+	res->parts = NULL;
+	res->count = 0;
+	res->size = 0;
+	res->header = NULL;
+
+	/* just refer to the data if raw */
 	if (raw) {
-		*free_it = false;
+		const void *data;
+
 		/* get_resource_entry will print possible error */
-		return get_resource_entry(fi, wr, size);
+		data = get_resource_entry(fi, wr, &res->size);
+		if (data == NULL)
+			return false;
+		res->parts = xmalloc(sizeof(ResourcePart));
+		res->parts[0].data = data;
+		res->parts[0].size = res->size;
+		res->count = 1;
+		return true;
 	}
 
 	/* find out how to extract */
-	str = type;
-	if (str != NULL && parse_int32(STRIP_RES_ID_FORMAT(str), &intval)) {
-		if (intval == (int) RT_BITMAP) {
-			*free_it = true;
-			return extract_bitmap_resource(fi, wr, size);
+	if (type->numeric_id) {
+		if (type->value == (int) RT_BITMAP)
+			return extract_bitmap_resource(fi, wr, res);
+		if (type->value == (int) RT_GROUP_ICON)
+			return extract_group_icon_cursor_resource(fi, wr, lang, res, true);
+		if (type->value == (int) RT_GROUP_CURSOR)
+			return extract_group_icon_cursor_resource(fi, wr, lang, res, false);
+	}
+
+	warn(_("%s: don't know how to extract resource, try `--raw'"), fi->name);
+	return false;
+}
+
+/* extracted_resource_data:
+ *   Return the contents of an extracted resource in a single memory
+ *   block. The parts are only copied if there are more than one, in
+ *   which case free_it is set and the block should be freed with
+ *   free() once used.
+ */
+void *
+extracted_resource_data (ExtractedResource *res, bool *free_it)
+{
+	char *memory;
+	size_t offset;
+	int c;
+
+	if (res->count == 1) {
+		*free_it = false;
+		return (void *) res->parts[0].data;
+	}
+
+	memory = xmalloc(res->size);
+	for (c = 0, offset = 0 ; c < res->count ; c++) {
+		memcpy(memory + offset, res->parts[c].data, res->parts[c].size);
+		offset += res->parts[c].size;
+	}
+	*free_it = true;
+	return memory;
+}
+
+/* write_parts:
+ *   Write parts of an extracted resource from memory to out, which
+ *   has been flushed. Where writev is available, the parts are written
+ *   directly, bypassing the buffer of out. Returns false with errno
+ *   set on error.
+ */
+static bool
+write_parts (ResourcePart *parts, int count, FILE *out)
+{
+#if HAVE_WRITEV
+	struct iovec iov[WRITE_PARTS_MAX];
+	size_t done = 0;	/* bytes of parts[c] written so far */
+	int c = 0;
+
+	while (c < count) {
+		ssize_t written;
+		int n;
+
+		for (n = 0 ; n < WRITE_PARTS_MAX && c + n < count ; n++) {
+			iov[n].iov_base = (char *) parts[c+n].data + (n == 0 ? done : 0);
+			iov[n].iov_len = parts[c+n].size - (n == 0 ? done : 0);
 		}
-		if (intval == (int) RT_GROUP_ICON) {
-			*free_it = true;
-			return extract_group_icon_cursor_resource(fi, wr, lang, size, true);
+		written = writev(fileno(out), iov, n);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
 		}
-		if (intval == (int) RT_GROUP_CURSOR) {
-			*free_it = true;
-			return extract_group_icon_cursor_resource(fi, wr, lang, size, false);
+
+		/* skip the parts written, possibly ending in the middle of one */
+		for (; c < count && (size_t) written >= parts[c].size - done ; c++) {
+			written -= parts[c].size - done;
+			done = 0;
 		}
+		done += written;
 	}
+	return true;
+#else
+	int c;
 
-	warn(_("%s: don't know how to extract resource, try `--raw'"), fi->name);
-	return NULL;
+	for (c = 0 ; c < count ; c++) {
+		if (parts[c].size != 0 && fwrite(parts[c].data, parts[c].size, 1, out) != 1)
+			return false;
+	}
+	return fflush(out) == 0;
+#endif
+}
+
+/* copy_library_part:
+ *   Write a part that lies in the library to out, which has been
+ *   flushed, letting the kernel copy it from the library file where
+ *   possible. The data is then never read into memory. Anything the
+ *   kernel will not copy (such as to a file on another file system
+ *   with older kernels) is written from memory instead. Returns false
+ *   with errno set on error.
+ */
+static bool
+copy_library_part (WinLibrary *fi, ResourcePart *part, FILE *out)
+{
+	off_t offset = (const char *) part->data - fi->memory;
+	size_t left = part->size;
+	ResourcePart rest;
+#if USE_COPY_FILE_RANGE || USE_SENDFILE
+	ssize_t copied;
+#endif
+
+#if USE_COPY_FILE_RANGE
+	while (left > 0) {
+		copied = copy_file_range(fi->fd, &offset, fileno(out), NULL, left, 0);
+		if (copied < 0 && errno == EINTR)
+			continue;
+		if (copied <= 0)
+			break;
+		left -= copied;
+	}
+#endif
+#if USE_SENDFILE
+	while (left > 0) {
+		copied = sendfile(fileno(out), fi->fd, &offset, left);
+		if (copied < 0 && errno == EINTR)
+			continue;
+		if (copied <= 0)
+			break;
+		left -= copied;
+	}
+#endif
+
+	rest.data = fi->memory + offset;
+	rest.size = left;
+	return write_parts(&rest, 1, out);
+}
+
+/* write_extracted_resource:
+ *   Write an extracted resource to out. Large parts in the library
+ *   are copied by the kernel if possible, other parts are written
+ *   from memory. Returns false with errno set on error.
+ */
+bool
+write_extracted_resource (WinLibrary *fi, ExtractedResource *res, FILE *out)
+{
+	int c, first;
+
+	/* anything buffered must come first */
+	if (fflush(out) != 0)
+		return false;
+
+	for (c = first = 0 ; c < res->count ; c++) {
+		ResourcePart *part = &res->parts[c];
+
+		if (part->size < KERNEL_COPY_MIN
+		    || (const char *) part->data < fi->memory
+		    || (const char *) part->data >= fi->memory + fi->total_size)
+			continue;
+
+		if (!write_parts(res->parts + first, c - first, out)
+		    || !copy_library_part(fi, part, out))
+			return false;
+		first = c + 1;
+	}
+	return write_parts(res->parts + first, c - first, out);
+}
+
+void
+free_extracted_resource (ExtractedResource *res)
+{
+	free(res->parts);
+	free(res->header);
+	res->parts = NULL;
+	res->header = NULL;
+	res->count = 0;
 }
 
 /* extract_group_icon_resource:
  *   Create a complete RT_GROUP_ICON resource, that can be written to
- *   an `.ico' file without modifications. Returns an allocated
- *   memory block that should be freed with free() once used.
+ *   an `.ico' file without modifications. The directory of the file
+ *   is allocated as the header of res, followed by the images in the
+ *   library. Returns false if an error occured.
  *
- *   `root' is the offset in file that specifies the resource.
- *   `base' is the offset that string pointers are calculated from.
- *   `ressize' should point to an integer variable where the size of
- *   the returned memory block will be placed.
  *   `is_icon' indicates whether resource to be extracted is icon
  *   or cursor group.
  */
-static void *
-extract_group_icon_cursor_resource(WinLibrary *fi, WinResource *wr, char *lang,
-                                   int *ressize, bool is_icon)
+static bool
+extract_group_icon_cursor_resource(WinLibrary *fi, WinResource *wr, WinResource *lang,
+                                   ExtractedResource *res, bool is_icon)
 {
 	Win32CursorIconDir *icondir;
 	Win32CursorIconFileDir *fileicondir;
-	char *memory;
-	int c, size, offset, skipped;
+	int c, skipped;
+	size_t size, offset;
+	uint64_t total;
 
 	/* get resource data and size */
 	icondir = (Win32CursorIconDir *) get_resource_entry(fi, wr, &size);
 	if (icondir == NULL) {
 		/* get_resource_entry will print error */
-		return NULL;
+		return false;
 	}
 
 	/* calculate total size of output file */
-	RETURN_IF_BAD_POINTER(NULL, icondir->count);
+	RETURN_IF_BAD_POINTER(false, icondir->count);
 	skipped = 0;
+	total = 0;
 	for (c = 0 ; c < icondir->count ; c++) {
-		int level;
-	    	int iconsize;
-		char name[14];
+	    	size_t iconsize;
 		WinResource *fwr;
 
-		RETURN_IF_BAD_POINTER(NULL, icondir->entries[c]);
+		RETURN_IF_BAD_POINTER(false, icondir->entries[c]);
 		/*printf("%d. bytes_in_res=%d width=%d height=%d planes=%d bit_count=%d\n", c,
 			icondir->entries[c].bytes_in_res,
 			(is_icon ? icondir->entries[c].res_info.icon.width : icondir->entries[c].res_info.cursor.width),
@@ -155,38 +411,54 @@ extract_group_icon_cursor_resource(WinLibrary *fi, WinResource *wr, char *lang,
 			icondir->entries[c].bit_count);*/
 
 		/* find the corresponding icon resource */
-		snprintf(name, sizeof(name)/sizeof(char), "-%d", icondir->entries[c].res_id);
-		fwr = find_resource(fi, (is_icon ? "-3" : "-1"), name, lang, &level);
+		fwr = find_resource(fi, (is_icon ? RT_ICON : RT_CURSOR), icondir->entries[c].res_id, lang);
 		if (fwr == NULL) {
-			warn(_("%s: could not find `%s' in `%s' resource."),
-			 	fi->name, &name[1], (is_icon ? "group_icon" : "group_cursor"));
-			return NULL;
+			warn(_("%s: could not find `%d' in `%s' resource."),
+			 	fi->name, icondir->entries[c].res_id, (is_icon ? "group_icon" : "group_cursor"));
+			return false;
 		}
 
 		if (get_resource_entry(fi, fwr, &iconsize) != NULL) {
 		    if (iconsize == 0) {
-			warn(_("%s: icon resource `%s' is empty, skipping"), fi->name, name);
+			warn(_("%s: icon resource `-%d' is empty, skipping"), fi->name, icondir->entries[c].res_id);
 			skipped++;
 			continue;
 		    }
 		    if (iconsize != icondir->entries[c].bytes_in_res) {
-			warn(_("%s: mismatch of size in icon resource `%s' and group (%d vs %d)"), fi->name, name, iconsize, icondir->entries[c].bytes_in_res);
+			warn(_("%s: mismatch of size in icon resource `-%d' and group (%lu vs %lu)"), fi->name, icondir->entries[c].res_id,
+			     (unsigned long) iconsize, (unsigned long) icondir->entries[c].bytes_in_res);
 		    }
-		    size += iconsize; /* size += icondir->entries[c].bytes_in_res; */
+		    /* only the smaller of the sizes is copied below */
+		    iconsize = MIN(iconsize, icondir->entries[c].bytes_in_res);
 
 		    /* cursor resources have two additional WORDs that contain
 		     * hotspot info */
-		    if (!is_icon)
-			size -= sizeof(uint16_t)*2;
+		    if (!is_icon) {
+			if (iconsize < sizeof(uint16_t)*2) {
+			    warn(_("%s: premature end"), fi->name);
+			    return false;
+			}
+			iconsize -= sizeof(uint16_t)*2;
+		    }
+		    total += iconsize;
 		}
 	}
 	offset = sizeof(Win32CursorIconFileDir) + (icondir->count-skipped) * sizeof(Win32CursorIconFileDirEntry);
-	size += offset;
-	*ressize = size;
+	total += offset;
+	/* image offsets in icon files are 32-bit */
+	if (total > UINT32_MAX || total > SIZE_MAX) {
+		warn(_("%s: resource too large"), fi->name);
+		return false;
+	}
 
-	/* allocate that much memory */
-	memory = xmalloc(size);
-	fileicondir = (Win32CursorIconFileDir *) memory;
+	/* allocate the directory, and a part for it and each image */
+	fileicondir = xmalloc(offset);
+	res->header = fileicondir;
+	res->parts = xnmalloc(icondir->count - skipped + 1, sizeof(ResourcePart));
+	res->parts[0].data = fileicondir;
+	res->parts[0].size = offset;
+	res->count = 1;
+	res->size = total;
 
 	/* transfer Win32CursorIconDir structure members */
 	fileicondir->reserved = icondir->reserved;
@@ -196,25 +468,24 @@ extract_group_icon_cursor_resource(WinLibrary *fi, WinResource *wr, char *lang,
 	/* transfer each cursor/icon: Win32CursorIconDirEntry and data */
 	skipped = 0;
 	for (c = 0 ; c < icondir->count ; c++) {
-		int level;
-		char name[14];
 		WinResource *fwr;
 		char *data;
 	
 		/* find the corresponding icon resource */
-		snprintf(name, sizeof(name)/sizeof(char), "-%d", icondir->entries[c].res_id);
-		fwr = find_resource(fi, (is_icon ? "-3" : "-1"), name, lang, &level);
+		fwr = find_resource(fi, (is_icon ? RT_ICON : RT_CURSOR), icondir->entries[c].res_id, lang);
 		if (fwr == NULL) {
-			warn(_("%s: could not find `%s' in `%s' resource."),
-			 	fi->name, &name[1], (is_icon ? "group_icon" : "group_cursor"));
-			return NULL;
+			warn(_("%s: could not find `%d' in `%s' resource."),
+			 	fi->name, icondir->entries[c].res_id, (is_icon ? "group_icon" : "group_cursor"));
+			free_extracted_resource(res);
+			return false;
 		}
 
 		/* get data and size of that resource */
 		data = get_resource_entry(fi, fwr, &size);
 		if (data == NULL) {
 			/* get_resource_entry has printed error */
-			return NULL;
+			free_extracted_resource(res);
+			return false;
 		}
     	    	if (size == 0) {
 		    skipped++;
@@ -236,42 +507,49 @@ extract_group_icon_cursor_resource(WinLibrary *fi, WinResource *wr, char *lang,
 		/* set image offset and increase it */
 		fileicondir->entries[c-skipped].dib_offset = offset;
 
-		/* transfer resource into file memory */
-		if (is_icon) {
-			memcpy(&memory[offset], data, icondir->entries[c].bytes_in_res);
-		} else {
+		/* refer to the image in the library, never to more than
+		 * the resource holds */
+		size = MIN(size, icondir->entries[c].bytes_in_res);
+		if (!is_icon) {
 			fileicondir->entries[c-skipped].hotspot_x = ((uint16_t *) data)[0];
 			fileicondir->entries[c-skipped].hotspot_y = ((uint16_t *) data)[1];
-			memcpy(&memory[offset], data+sizeof(uint16_t)*2,
-				   icondir->entries[c].bytes_in_res-sizeof(uint16_t)*2);
-			offset -= sizeof(uint16_t)*2;
+			data += sizeof(uint16_t)*2;
+			size -= sizeof(uint16_t)*2;
 		}
+		res->parts[res->count].data = data;
+		res->parts[res->count].size = size;
+		res->count++;
 
 		/* increase the offset pointer */
-		offset += icondir->entries[c].bytes_in_res;
+		offset += size;
 	}
 
-	return (void *) memory;
+	return true;
 }
 
 /* extract_bitmap_resource:
  *   Create a complete RT_BITMAP resource, that can be written to
- *   an `.bmp' file without modifications. Returns an allocated
- *   memory block that should be freed with free() once used.
- *
- *   `ressize' should point to an integer variable where the size of
- *   the returned memory block will be placed.
+ *   an `.bmp' file without modifications. The file header is
+ *   allocated as the header of res, followed by the bitmap in the
+ *   library. Returns false if an error occured.
  */
-static void *
-extract_bitmap_resource(WinLibrary *fi, WinResource *wr, int *ressize)
+static bool
+extract_bitmap_resource(WinLibrary *fi, WinResource *wr, ExtractedResource *res)
 {
     Win32BitmapInfoHeader info;
     uint8_t *result;
     uint8_t *resentry;
     uint32_t offbits;
-    int size;
+    size_t size;
 
     resentry=(uint8_t *)(get_resource_entry(fi,wr,&size));
+    if (resentry == NULL)
+        return false;
+    /* the file size field of bitmap files is 32-bit */
+    if (size < sizeof(info) || size > UINT32_MAX - 14) {
+        warn(_("%s: invalid bitmap resource"), fi->name);
+        return false;
+    }
 
     /* Bitmap file consists of:
      * 1) File header (14 bytes)
@@ -317,16 +595,16 @@ extract_bitmap_resource(WinLibrary *fi, WinResource *wr, int *ressize)
 
     /* The file will consist of the resource data and
      * 14 bytes long file header */
-    *ressize = 14+size;
-    result = (uint8_t *)xmalloc(*ressize);
+    res->size = 14+size;
+    result = (uint8_t *)xmalloc(14);
 
     /* Filling the file header with data */
     result[0] = 'B';   /* Magic char #1 */
     result[1] = 'M';   /* Magic char #2 */
-    result[2] = (*ressize & 0x000000ff);      /* file size, little-endian */
-    result[3] = (*ressize & 0x0000ff00)>>8;
-    result[4] = (*ressize & 0x00ff0000)>>16;
-    result[5] = (*ressize & 0xff000000)>>24;
+    result[2] = (res->size & 0x000000ff);      /* file size, little-endian */
+    result[3] = (res->size & 0x0000ff00)>>8;
+    result[4] = (res->size & 0x00ff0000)>>16;
+    result[5] = (res->size & 0xff000000)>>24;
     result[6] = 0; /* Reserved */
     result[7] = 0;
     result[8] = 0;
@@ -337,7 +615,13 @@ extract_bitmap_resource(WinLibrary *fi, WinResource *wr, int *ressize)
     result[13] = (offbits & 0xff000000)>>24;
 
     /* The rest of the file is the resource entry */
-    memcpy(result+14,resentry,size);
-
-    return result;
+    res->header = result;
+    res->parts = xnmalloc(2, sizeof(ResourcePart));
+    res->parts[0].data = result;
+    res->parts[0].size = 14;
+    res->parts[1].data = resentry;
+    res->parts[1].size = size;
+    res->count = 2;
+
+    return true;
 }
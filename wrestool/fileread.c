@@ -1,4 +1,4 @@
-/* fileread.c - Offset checking routines for file reading
+/* fileread.c - File mapping and offset checking routines
  *
  * Copyright (C) 1998 Oskar Liljeblad
  *
@@ -17,6 +17,13 @@
  */
 
 #include <config.h>
+#include <sys/types.h>		/* POSIX */
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>		/* POSIX */
+#endif
+#include <fcntl.h>		/* POSIX */
+#include <unistd.h>		/* POSIX */
+#include <errno.h>		/* C89 */
 #include <stdio.h>		/* C89 */
 #include <stdlib.h>		/* C89 */
 #include <string.h>		/* C89 */
@@ -24,26 +31,215 @@
 #include "gettext.h"			/* Gnulib */
 #define _(s) gettext(s)
 #define N_(s) gettext_noop(s)
+#include "xalloc.h"		/* Gnulib */
+#include "minmax.h"		/* Gnulib */
 #include "common/error.h"
 #include "common/common.h"
+#include "wrestool.h"
+#include "fileread.h"
+
+/* Parts of files that cannot be mapped are read on demand, in chunks
+ * of this many bytes (as a power of two). */
+#define CHUNK_SHIFT		16
+#define CHUNK_LOADED(fi,c)	((fi)->loaded_chunks[(c) >> 3] & (1 << ((c) & 7)))
+
+static bool load_range(WinLibrary *fi, size_t start, size_t size);
 
 /* check_offset:
  *   Check if a chunk of data (determined by offset and size)
- *   is within the bounds of the WinLibrary file.
+ *   is within the bounds of the WinLibrary file, and make sure
+ *   it has been read.
  *   Usually not called directly.
  */
 bool
-check_offset(char *memory, int total_size, char *name, void *offset, int size)
+check_offset(WinLibrary *fi, void *offset, size_t size)
 {
-	int need_size = (int) ((char *) offset - memory + size);
+	size_t start;
+
+	/* compare sizes rather than pointers, which could overflow */
+	if ((char *) offset < fi->memory
+	    || (start = (char *) offset - fi->memory) > fi->total_size
+	    || size > fi->total_size - start) {
+		warn(_("%s: premature end"), fi->name);
+		return false;
+	}
+
+	if (fi->loaded_chunks != NULL)
+		return load_range(fi, start, size);
+	return true;
+}
 
-	/*debug("check_offset: size=%x vs %x offset=%x size=%x\n",
-		need_size, total_size, (char *) offset - memory, size);*/
+/* read_at:
+ *   Read size bytes at offset of a file into buf. Returns false
+ *   with errno set on error.
+ */
+static bool
+read_at(int fd, char *buf, off_t offset, size_t size)
+{
+	size_t done;
 
-	if (need_size < 0 || need_size > total_size) {
-		warn(_("%s: premature end"), name);
+	if (lseek(fd, offset, SEEK_SET) == (off_t) -1)
 		return false;
+	for (done = 0 ; done < size ; ) {
+		ssize_t count = read(fd, buf + done, size - done);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0) {
+			if (count == 0)
+				errno = EIO;
+			return false;
+		}
+		done += count;
 	}
 
 	return true;
 }
+
+/* load_range:
+ *   Read the chunks of the file covering a range that have not been
+ *   read yet. Consecutive chunks are read at once.
+ */
+static bool
+load_range(WinLibrary *fi, size_t start, size_t size)
+{
+	size_t c, end, last;
+
+	if (size == 0)
+		return true;
+
+	last = (start + size - 1) >> CHUNK_SHIFT;
+	for (c = start >> CHUNK_SHIFT ; c <= last ; c = end) {
+		size_t offset, count;
+
+		if (CHUNK_LOADED(fi, c)) {
+			end = c+1;
+			continue;
+		}
+		for (end = c+1 ; end <= last && !CHUNK_LOADED(fi, end) ; end++);
+
+		offset = c << CHUNK_SHIFT;
+		count = MIN(fi->total_size - offset, (end - c) << CHUNK_SHIFT);
+		if (!read_at(fi->fd, fi->memory + offset, offset, count)) {
+			warn_errno("%s", fi->name);
+			return false;
+		}
+		for ( ; c < end ; c++)
+			fi->loaded_chunks[c >> 3] |= 1 << (c & 7);
+	}
+
+	return true;
+}
+
+/* sniff_library:
+ *   Check the headers at the start of a file, reading no more than a
+ *   page of it, to skip files that are not libraries before mapping
+ *   them. This makes the same decisions as find_resource_table when
+ *   the headers are within the part read. Files with a DOS header
+ *   whose new header lies further on are left to read_library, other
+ *   files without a signature in the part read are not libraries.
+ *   Returns false if the file is certainly not a PE or NE library.
+ */
+bool
+sniff_library(WinLibrary *fi)
+{
+	char buf[4096];
+	size_t size = MIN(fi->total_size, MIN(sizeof(buf), (size_t) getpagesize()));
+	DOSImageHeader *mz_header = (DOSImageHeader *) buf;
+
+	/* read errors are reported when the file is read */
+	if (!read_at(fi->fd, buf, 0, size))
+		return true;
+
+	if (size >= sizeof(mz_header->magic) && mz_header->magic == IMAGE_DOS_SIGNATURE) {
+		if (size < sizeof(DOSImageHeader) || mz_header->lfanew > size - sizeof(uint32_t))
+			return true;
+		if (mz_header->lfanew < sizeof(DOSImageHeader))
+			return false;
+	} else if (size < sizeof(DOSImageHeader) || mz_header->lfanew > size - sizeof(uint32_t)) {
+		return false;
+	}
+
+	return memcmp(buf + mz_header->lfanew, "NE", 2) == 0
+	    || memcmp(buf + mz_header->lfanew, "PE\0\0", 4) == 0;
+}
+
+/* map_library:
+ *   Make the contents of the opened file fi->fd available at
+ *   fi->memory. The file is mapped read-only if possible, so that
+ *   only the pages actually referenced by the resource table are
+ *   ever read. Otherwise memory for the file is allocated, and
+ *   parts of it are read as they are checked with check_offset.
+ *   Returns false with errno set on error.
+ */
+bool
+map_library(WinLibrary *fi)
+{
+	fi->loaded_chunks = NULL;
+
+#if HAVE_SYS_MMAN_H
+	fi->memory = mmap(NULL, fi->total_size, PROT_READ, MAP_PRIVATE, fi->fd, 0);
+	if (fi->memory != MAP_FAILED) {
+		fi->is_mapped = true;
+#ifdef MADV_RANDOM
+		/* only a small part of most files is ever looked at, so
+		 * do not read ahead of the pages referenced */
+		madvise(fi->memory, fi->total_size, MADV_RANDOM);
+#endif
+		return true;
+	}
+#endif
+
+	/* with calloc, the untouched parts do not take up memory on
+	 * most systems */
+	fi->is_mapped = false;
+	fi->memory = xcalloc(fi->total_size, 1);
+	fi->loaded_chunks = xcalloc(((fi->total_size - 1) >> CHUNK_SHIFT) / 8 + 1, 1);
+	return true;
+}
+
+/* prefetch_library:
+ *   Read a part of the file that will be looked at in whole, such as
+ *   the resource section, at once. The range is clipped to the file.
+ *   Errors are reported when the data is checked.
+ */
+void
+prefetch_library(WinLibrary *fi, size_t offset, size_t size)
+{
+	if (offset >= fi->total_size)
+		return;
+	size = MIN(size, fi->total_size - offset);
+
+	if (fi->loaded_chunks != NULL) {
+		load_range(fi, offset, size);
+		return;
+	}
+#if HAVE_SYS_MMAN_H && defined MADV_WILLNEED
+	if (fi->is_mapped) {
+		size_t start = offset & ~((size_t) getpagesize() - 1);
+		madvise(fi->memory + start, size + (offset - start), MADV_WILLNEED);
+	}
+#endif
+}
+
+/* unmap_library:
+ *   Release the memory set up by map_library and close the file.
+ */
+void
+unmap_library(WinLibrary *fi)
+{
+	if (fi->memory != NULL) {
+#if HAVE_SYS_MMAN_H
+		if (fi->is_mapped)
+			munmap(fi->memory, fi->total_size);
+		else
+#endif
+			free(fi->memory);
+		free(fi->loaded_chunks);
+		fi->memory = NULL;
+		fi->loaded_chunks = NULL;
+	}
+	if (fi->fd != -1) {
+		close(fi->fd);
+		fi->fd = -1;
+	}
+}
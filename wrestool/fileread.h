@@ -23,16 +23,18 @@
 #include "common/common.h"
 
 #define RETURN_IF_BAD_POINTER(r, x) \
-	if (!check_offset(fi->memory, fi->total_size, fi->name, &(x), sizeof(x))) { \
+	if (!check_offset(fi, &(x), sizeof(x))) { \
 		/*printf("bad_pointer in %s:%d\n", __FILE__, __LINE__);*/ \
 		return (r); \
 	}
 #define RETURN_IF_BAD_OFFSET(r, x, s) \
-	if (!check_offset(fi->memory, fi->total_size, fi->name, x, s)) { \
+	if (!check_offset(fi, x, s)) { \
 		/*printf("bad_offset in %s:%d\n", __FILE__, __LINE__);*/ \
 		return (r); \
 	}
 
-bool check_offset(char *, int, char *, void *, int);
+struct _WinLibrary;
+
+bool check_offset(struct _WinLibrary *, void *, size_t);
 
 #endif
@@ -17,6 +17,9 @@
  */
 
 #include <config.h>
+#include <errno.h>			/* C89 */
+#include <fcntl.h>			/* POSIX */
+#include <sys/stat.h>			/* POSIX */
 #include "gettext.h"			/* Gnulib */
 #include "configmake.h"
 #define _(s) gettext(s)
@@ -25,23 +28,46 @@
 #include "progname.h"			/* Gnulib */
 //#include "strcase.h"			/* Gnulib */
 #include "dirname.h"			/* Gnulib */
+#include "minmax.h"			/* Gnulib */
 #include "common/error.h"
 #include "xalloc.h"			/* Gnulib */
 #include "common/intutil.h"
 #include "common/io-utils.h"
 #include "common/string-utils.h"
+#include "common/jobs.h"
 #include "wrestool.h"
+#include "icotool.h"
 
 #define PROGRAM "wrestool"
 
 
 enum {
     OPT_VERSION = 1000,
-    OPT_HELP
+    OPT_HELP,
+    OPT_CONVERT,
+    OPT_BATCH,
+    OPT_SCRIPT,
+    OPT_QUIET_NON_PE,
+    OPT_FORMAT
 };
 
+/* number of libraries kept open by --batch */
+#define LIBRARY_CACHE_SIZE 8
+
+typedef struct {
+	WinLibrary fi;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	unsigned long last_use;
+} CachedLibrary;
+
 const char version_etc_copyright[] = "Copyright (C) 1998 Oskar Liljeblad";
 bool arg_raw;
+bool arg_convert;
+bool arg_quiet_non_pe;
+JsonWriter *json_output;
 static FILE *verbose_file;
 static int arg_verbosity;
 static char *arg_output;
@@ -49,6 +75,13 @@ static char *arg_type;
 static char *arg_name;
 static char *arg_language;
 static int arg_action;
+static int32_t arg_jobs;
+static bool arg_batch;
+static bool arg_recursive;
+static bool arg_json;
+static char *arg_script;
+static Arena *library_arena;
+static CachedLibrary library_cache[LIBRARY_CACHE_SIZE];
 static char *res_types[] = {
     /* 0x01: */
     "cursor", "bitmap", "icon", "menu", "dialog", "string",
@@ -61,7 +94,6 @@ static char *res_types[] = {
 };
 #define RES_TYPE_COUNT (sizeof(res_types)/sizeof(char *))
 
-static char *res_type_string_to_id (char *);
 static char *get_extract_extension (char *);
 
 /* res_type_id_to_string:
@@ -82,7 +114,7 @@ res_type_id_to_string (int id)
  *   Translate a resource type string to integer.
  *   (Used to convert the --type option.)
  */
-static char *
+char *
 res_type_string_to_id (char *type)
 {
     static char *res_type_ids[] = {
@@ -153,20 +185,19 @@ get_destination_name (WinLibrary *fi, char *type, char *name, char *lang)
 
     /* if --output'ing to a directory, make filename */
     if (is_directory(arg_output) || ends_with(arg_output, "/")) {
-	/* char *tmp = strdup(fi->name);
-	if (tmp == NULL)
-	    malloc_failure(); */
+	/* base_name allocates the name, which matters in batch mode */
+	char *base = base_name(fi->name);
 
 	snprintf (filename, 1024, "%s%s%s_%s_%s%s%s%s",
 			  arg_output,
 		      (ends_with(arg_output, "/") ? "" : "/"),
-			  base_name(fi->name),
+			  base,
 			  type,
 			  name,
 			  (lang != NULL && fi->is_PE_binary ? "_" : ""),
 			  (lang != NULL && fi->is_PE_binary ? lang : ""),
 			  get_extract_extension(type));
-	/* free(tmp); */
+	free(base);
 	return filename;
     }
 
@@ -190,23 +221,343 @@ display_help(void)
     printf(_("\nMiscellaneous:\n"));
     printf(_("  -o, --output=PATH       where to place extracted files\n"));
     printf(_("  -R, --raw               do not parse resource contents\n"));
+    printf(_("      --format=FORMAT     list as `text' (default) or `json', one record\n"
+             "                          per line\n"));
+    printf(_("      --convert=png       write icon and cursor images as PNG files\n"));
+    printf(_("  -r, --recursive         process the libraries in directories recursively\n"));
+    printf(_("  -j, --jobs=N            process up to N files at the same time\n"));
+    printf(_("      --batch             read commands from standard input\n"));
+    printf(_("      --script=FILE       extract the resources listed in a resource script\n"));
+    printf(_("      --quiet-non-pe      do not warn about files that are not libraries\n"));
     printf(_("  -v, --verbose           explain what is being done\n"));
     printf(_("      --help              display this help and exit\n"));
     printf(_("      --version           output version information and exit\n"));
     printf(_("\nA leading `+' in --type, name or language options indicates a true string\n"
-             "identifier. Similarly, `-' indicates a true numeric identifier.\n\n"));
+             "identifier. Similarly, `-' indicates a true numeric identifier.\n"));
+    printf(_("\nIn batch mode each line of input is a command of tab-separated fields\n"
+             "FILE, TYPE, NAME, LANGUAGE and OUTPUT. Empty or missing fields default\n"
+             "to the corresponding options. A status line is written for each command.\n\n"));
     printf(_("Report bugs to %s.\n"), PACKAGE_BUGREPORT);
 }
 
+/* open_library:
+ *   Open, map and index a library. Returns 1 on success, 0 if the
+ *   file is empty or not a Windows binary (a warning has then been
+ *   printed), or -1 with errno set if the file could not be read.
+ *   The library should be closed with close_library, even on error.
+ */
+int
+open_library (WinLibrary *fi, char *name, Arena *arena)
+{
+	off_t size;
+
+	fi->name = name;
+	fi->fd = -1;
+	fi->memory = NULL;
+	fi->entries = NULL;
+	fi->index = NULL;
+	fi->arena = arena;
+
+	/* get file size */
+	size = file_size(fi->name);
+	if (size == -1)
+		return -1;
+	/* all of the file must be addressable */
+	if ((uintmax_t) size > SIZE_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+	fi->total_size = size;
+	if (fi->total_size == 0) {
+		if (!arg_quiet_non_pe)
+			warn(_("%s: file has a size of 0"), fi->name);
+		return 0;
+	}
+
+	/* open file */
+	fi->fd = open(fi->name, O_RDONLY);
+	if (fi->fd == -1)
+		return -1;
+
+	/* skip other files before mapping them */
+	if (!sniff_library(fi)) {
+		if (!arg_quiet_non_pe)
+			warn(_("%s: not a PE or NE library"), fi->name);
+		return 0;
+	}
+
+	/* map file into memory */
+	if (!map_library(fi))
+		return -1;
+
+	/* identify file and find resource table */
+	if (!read_library (fi)) {
+		/* error reported by read_library */
+		return 0;
+	}
+
+	return 1;
+}
+
+void
+close_library (WinLibrary *fi)
+{
+	free_library_index(fi);
+	unmap_library(fi);
+	arena_reset(fi->arena);
+}
+
+/* process_library:
+ *   Do the specified command on the resources of an opened library.
+ *   Returns the number of resources matched, or -1 on error.
+ */
+static int
+process_library (WinLibrary *fi, char *type, char *name, char *language)
+{
+//	verbose_printf("file is a %s\n",
+//		fi->is_PE_binary ? "Windows NT `PE' binary" : "Windows 3.1 `NE' binary");
+
+	/* warn about more unnecessary options */
+	if (!fi->is_PE_binary && language != NULL)
+		warn(_("%s: --language has no effect because file is 16-bit binary"), fi->name);
+
+	/* do the specified command */
+	if (arg_action == ACTION_LIST) {
+		int count = do_resources (fi, type, name, language, print_resources_callback);
+		/* errors will be printed by the callback */
+		/* records must be written before the job or batch command ends */
+		if (json_output != NULL)
+			json_writer_flush(json_output);
+		return count;
+	} else if (arg_action == ACTION_EXTRACT) {
+		return do_resources (fi, type, name, language, extract_resources_callback);
+		/* errors will be printed by the callback */
+	}
+
+	return 0;
+}
+
+/* process_file:
+ *   List or extract the resources of one file. This is run as a
+ *   job, possibly in a worker process of its own.
+ */
+static int
+process_file (void *data)
+{
+	WinLibrary fi;
+	int status;
+
+	status = open_library(&fi, data, library_arena);
+	if (status < 0)
+		die_errno("%s", fi.name);
+	if (status > 0)
+		process_library(&fi, arg_type, arg_name, arg_language);
+
+	/* free stuff and close file */
+	close_library(&fi);
+	return 0;
+}
+
+/* is_library_file:
+ *   Check the first page of a file found by --recursive, so that
+ *   only libraries are handed to jobs. Other files are skipped
+ *   without a warning.
+ */
+static bool
+is_library_file (const char *name)
+{
+	WinLibrary fi;
+	struct stat st;
+	bool is_library;
+
+	fi.fd = open(name, O_RDONLY);
+	if (fi.fd == -1) {
+		warn_errno("%s", name);
+		return false;
+	}
+	if (fstat(fi.fd, &st) == -1) {
+		warn_errno("%s", name);
+		close(fi.fd);
+		return false;
+	}
+	/* sniff_library reads no more than a page */
+	fi.total_size = MIN((uintmax_t) st.st_size, SIZE_MAX);
+	is_library = fi.total_size > 0 && sniff_library(&fi);
+	close(fi.fd);
+	return is_library;
+}
+
+/* process_directory:
+ *   Submit the libraries below a directory to the job pool. Returns
+ *   false if the directory or one below it could not be read.
+ */
+static bool
+process_directory (JobPool *pool, char *dir)
+{
+	DirWalker *walker;
+	const char *name;
+	bool success;
+
+	walker = dir_walker_new(dir);
+	if (walker == NULL) {
+		warn_errno("%s", dir);
+		return false;
+	}
+	while ((name = dir_walker_next(walker)) != NULL) {
+		/* the job has been run or its worker forked when submit
+		 * returns, so the name need not outlive the call */
+		if (is_library_file(name))
+			job_pool_submit(pool, process_file, (char *) name);
+	}
+	success = !dir_walker_failed(walker);
+	dir_walker_free(walker);
+	return success;
+}
+
+/* get_cached_library:
+ *   Return an opened library for a file, reusing the one from an
+ *   earlier batch command if the file has not changed since. The
+ *   least recently used library is closed to make room for a new
+ *   one. Returns NULL if the file could not be opened (a warning
+ *   has then been printed).
+ */
+static WinLibrary *
+get_cached_library (char *name)
+{
+	static unsigned long use_count = 0;
+	CachedLibrary *lib, *victim;
+	struct stat st;
+	int c;
+
+	if (stat(name, &st) < 0) {
+		warn_errno("%s", name);
+		return NULL;
+	}
+
+	victim = &library_cache[0];
+	for (c = 0 ; c < LIBRARY_CACHE_SIZE ; c++) {
+		lib = &library_cache[c];
+		if (lib->fi.name != NULL && strcmp(lib->fi.name, name) == 0) {
+			if (lib->dev == st.st_dev && lib->ino == st.st_ino
+			    && lib->size == st.st_size && lib->mtime == st.st_mtime) {
+				lib->last_use = ++use_count;
+				return &lib->fi;
+			}
+			victim = lib;
+			break;
+		}
+		if (lib->last_use < victim->last_use)
+			victim = lib;
+	}
+
+	/* replace the victim, unused entries having a last_use of 0 */
+	lib = victim;
+	if (lib->fi.name != NULL) {
+		free(lib->fi.name);
+		close_library(&lib->fi);
+		lib->fi.name = NULL;
+	}
+	if (lib->fi.arena == NULL)
+		lib->fi.arena = arena_new(16384);
+
+	c = open_library(&lib->fi, xstrdup(name), lib->fi.arena);
+	if (c <= 0) {
+		if (c < 0)
+			warn_errno("%s", name);
+		free(lib->fi.name);
+		close_library(&lib->fi);
+		lib->fi.name = NULL;
+		lib->last_use = 0;
+		return NULL;
+	}
+
+	lib->dev = st.st_dev;
+	lib->ino = st.st_ino;
+	lib->size = st.st_size;
+	lib->mtime = st.st_mtime;
+	lib->last_use = ++use_count;
+	return &lib->fi;
+}
+
+#define EMPTY_TO_NULL(x) ((x) != NULL && (x)[0] != '\0' ? (x) : NULL)
+
+/* process_batch:
+ *   Read commands from standard input and carry them out, keeping
+ *   the libraries open between commands. For each command a line
+ *   `ok COUNT' is written to standard out, COUNT being the number
+ *   of resources matched, or `error' if the file could not be
+ *   processed. Any listing is written before the status line.
+ */
+static void
+process_batch (void)
+{
+	char *default_output = arg_output;
+	char *line = NULL;
+	size_t size = 0;
+	int c;
+
+	while (getline(&line, &size, stdin) >= 0) {
+		char *fields[5];
+		char *type, *name, *language;
+		WinLibrary *fi;
+		int count = -1;
+
+		chomp(line);
+		if (line[0] == '\0')
+			continue;
+		string_split_c(line, '\t', fields, 5);
+		type = EMPTY_TO_NULL(fields[1]);
+		name = EMPTY_TO_NULL(fields[2]);
+		language = EMPTY_TO_NULL(fields[3]);
+		type = (type == NULL ? arg_type : res_type_string_to_id(type));
+		SET_IF_NULL(name, arg_name);
+		SET_IF_NULL(language, arg_language);
+		arg_output = EMPTY_TO_NULL(fields[4]);
+		SET_IF_NULL(arg_output, default_output);
+
+		if (arg_action == ACTION_EXTRACT && arg_output == NULL) {
+			/* standard out is reserved for status lines */
+			warn(_("%s: no output specified for batch command"), fields[0]);
+		} else if ((fi = get_cached_library(fields[0])) != NULL) {
+			count = process_library(fi, type, name, language);
+		}
+
+		if (count == -1)
+			printf("error\n");
+		else
+			printf("ok %d\n", count);
+		fflush(stdout);
+	}
+
+	free(line);
+	for (c = 0 ; c < LIBRARY_CACHE_SIZE ; c++) {
+		if (library_cache[c].fi.name != NULL) {
+			free(library_cache[c].fi.name);
+			close_library(&library_cache[c].fi);
+		}
+		if (library_cache[c].fi.arena != NULL)
+			arena_free(library_cache[c].fi.arena);
+	}
+	arg_output = default_output;
+}
+
 int
 main (int argc, char **argv)
 {
+    JobPool *pool;
+    bool success = true;
     int c;
 
     arg_type = arg_name = arg_language = NULL;
     arg_verbosity = 0;
     arg_raw = false;
+    arg_convert = false;
     arg_action = ACTION_LIST;
+    arg_jobs = 1;
+    arg_batch = false;
+    arg_recursive = false;
+    arg_json = false;
+    arg_script = NULL;
 
 #ifdef ENABLE_NLS
     if (setlocale(LC_ALL, "") == NULL)
@@ -229,14 +580,21 @@ main (int argc, char **argv)
 	    { "output",     required_argument,  NULL, 'o' },
 	    { "all",		no_argument,		NULL, 'a' },
 	    { "raw",        no_argument,        NULL, 'R' },
+	    { "convert",	required_argument,	NULL, OPT_CONVERT },
+	    { "format",		required_argument,	NULL, OPT_FORMAT },
 	    { "extract",	no_argument,		NULL, 'x' },
 	    { "list",		no_argument,		NULL, 'l' },
+	    { "recursive",	no_argument,		NULL, 'r' },
+	    { "jobs",		required_argument,	NULL, 'j' },
+	    { "batch",		no_argument,		NULL, OPT_BATCH },
+	    { "script",		required_argument,	NULL, OPT_SCRIPT },
+	    { "quiet-non-pe",	no_argument,		NULL, OPT_QUIET_NON_PE },
 	    { "verbose",	no_argument,		NULL, 'v' },
 	    { "version",	no_argument,		NULL, OPT_VERSION },
 	    { "help",		no_argument,		NULL, OPT_HELP },
 	    { 0, 0, 0, 0 }
 	};
-	c = getopt_long (argc, argv, "t:n:L:o:aRrxlv", long_options, &option_index);
+	c = getopt_long (argc, argv, "t:n:L:o:aRrxlj:v", long_options, &option_index);
 	if (c == EOF)
 	    break;
 
@@ -250,6 +608,27 @@ main (int argc, char **argv)
 	    case 'l': arg_action = ACTION_LIST; break;
 	    case 'v': arg_verbosity++; break;
 	    case 'o': arg_output = optarg; break;
+	    case 'r': arg_recursive = true; break;
+	    case OPT_CONVERT:
+		if (strcmp(optarg, "png") != 0)
+		    die(_("invalid convert value: %s"), optarg);
+		arg_convert = true;
+		break;
+	    case OPT_FORMAT:
+		if (strcmp(optarg, "json") == 0 || strcmp(optarg, "ndjson") == 0)
+		    arg_json = true;
+		else if (strcmp(optarg, "text") == 0)
+		    arg_json = false;
+		else
+		    die(_("invalid format value: %s"), optarg);
+		break;
+	    case 'j':
+		if (!parse_int32(optarg, &arg_jobs) || arg_jobs < 1)
+		    die(_("invalid jobs value: %s"), optarg);
+		break;
+	    case OPT_BATCH: arg_batch = true; break;
+	    case OPT_SCRIPT: arg_script = optarg; break;
+	    case OPT_QUIET_NON_PE: arg_quiet_non_pe = true; break;
 	    case OPT_VERSION:
 		version_etc(stdout, PROGRAM, PACKAGE, VERSION, "Oskar Liljeblad", NULL);
 		return 0;
@@ -270,80 +649,58 @@ main (int argc, char **argv)
 		warn(_("--language has no effect without --name and --type"));
 	    if (arg_name != NULL && arg_type == NULL)
 		warn(_("--name has no effect without --type"));
+	    if (arg_json)
+		json_output = json_writer_new(stdout);
+	} else if (arg_json) {
+	    warn(_("--format has no effect without --list"));
 	}
 
+	if ((arg_convert || arg_script != NULL || arg_batch) && dib_kernels_fallback())
+	    warn(_("optimized pixel conversion failed its self test, using portable code"));
+
 	/* translate --type option from resource type string to integer */
 	arg_type = res_type_string_to_id(arg_type);
 
+	/* files are named by the script or the batch commands */
+	if (arg_script != NULL) {
+		if (optind < argc)
+			die(_("file arguments cannot be used with --script"));
+		if (arg_batch)
+			die(_("only one of --batch and --script may be specified"));
+		return run_script(arg_script, arg_output, arg_jobs) ? 0 : 1;
+	}
+	if (arg_batch) {
+		if (optind < argc)
+			die(_("file arguments cannot be used with --batch"));
+		process_batch();
+		return 0;
+	}
+
 	/* make sure at least one file has been specified */
 	if (optind >= argc) {
 		warn(_("missing file argument\nTry `%s --help' for more information."), program_name);
 		return 1;
 	}
 
+	/* resource lists and ids of all files are allocated from
+	 * one arena, which is reset after each file */
+	library_arena = arena_new(16384);
+
 	/* for each file */
+	pool = job_pool_new(arg_jobs);
 	for (c = optind ; c < argc ; c++) {
-		WinLibrary fi;
-		
-		/* initiate stuff */
-		fi.file = NULL;
-		fi.memory = NULL;
-
-		/* get file size */
-		fi.name = argv[c];
-		fi.total_size = file_size(fi.name);
-		if (fi.total_size == -1) {
-			die_errno("%s", fi.name);
-			goto cleanup;
-		}
-		if (fi.total_size == 0) {
-			warn(_("%s: file has a size of 0"), fi.name);
-			goto cleanup;
+		if (arg_recursive && is_directory(argv[c])) {
+			if (!process_directory(pool, argv[c]))
+				success = false;
+		} else {
+			job_pool_submit(pool, process_file, argv[c]);
 		}
-
-		/* open file */
-		fi.file = fopen(fi.name, "rb");
-		if (fi.file == NULL) {
-			die_errno("%s", fi.name);
-			goto cleanup;
-		}
-		
-		/* read all of file */
-		fi.memory = xmalloc(fi.total_size);
-		if (fread(fi.memory, fi.total_size, 1, fi.file) != 1) {
-			die_errno("%s", fi.name);
-			goto cleanup;
-		}
-
-		/* identify file and find resource table */
-		if (!read_library (&fi)) {
-			/* error reported by read_library */
-			goto cleanup;
-		}
-
-	//	verbose_printf("file is a %s\n",
-	//		fi.is_PE_binary ? "Windows NT `PE' binary" : "Windows 3.1 `NE' binary");
-
-		/* warn about more unnecessary options */
-		if (!fi.is_PE_binary && arg_language != NULL)
-			warn(_("%s: --language has no effect because file is 16-bit binary"), fi.name);
-
-		/* do the specified command */
-		if (arg_action == ACTION_LIST) {
-			do_resources (&fi, arg_type, arg_name, arg_language, print_resources_callback);
-			/* errors will be printed by the callback */
-		} else if (arg_action == ACTION_EXTRACT) {
-			do_resources (&fi, arg_type, arg_name, arg_language, extract_resources_callback);
-			/* errors will be printed by the callback */
-		}
-
-		/* free stuff and close file */
-		cleanup:
-		if (fi.file != NULL)
-			fclose(fi.file);
-		if (fi.memory != NULL)
-			free(fi.memory);
 	}
+	if (!job_pool_finish(pool))
+		success = false;
 
-	return 0;
+	if (json_output != NULL)
+		json_writer_free(json_output);
+	arena_free(library_arena);
+	return success ? 0 : 1;
 }
@@ -17,6 +17,7 @@
  */
 
 #include <config.h>
+#include <stddef.h>		/* C89 */
 #include <inttypes.h>		/* ? */
 #include "gettext.h"		/* Gnulib */
 #define _(s) gettext(s)
@@ -24,54 +25,238 @@
 #include "common/intutil.h"
 #include "xalloc.h"		/* Gnulib */
 #include "minmax.h"		/* Gnulib */
+#include "intprops.h"		/* Gnulib */
 #include "common/error.h"
 #include "wrestool.h"
 #include "win32.h"
 #include "fileread.h"
 
+typedef struct _WinResourceRun WinResourceRun;
+
+/* A range of index entries that share the same type, or the same type
+ * and name. Entries of a run are consecutive in any sane resource table.
+ * The runs are both keys and values of the library index.
+ */
+struct _WinResourceRun {
+	WinResource *type;
+	WinResource *name;	/* NULL for runs of types */
+	int first;
+	int count;
+};
+
+/* A resource id specified by the user, parsed once before it is
+ * compared with the ids in the library. An id without `+' or `-'
+ * prefix may refer to both a numeric and a string id.
+ */
+typedef struct {
+	bool numeric;		/* may match the numeric id value */
+	int32_t value;
+	char *string;		/* may match this string id, unless NULL */
+} ResourceIdQuery;
+
+static void set_numeric_resource_id (WinLibrary *, WinResource *, int32_t);
 static bool decode_pe_resource_id (WinLibrary *, WinResource *, uint32_t);
 static bool decode_ne_resource_id (WinLibrary *, WinResource *, uint16_t);
 static WinResource *list_ne_type_resources (WinLibrary *, int *);
 static WinResource *list_ne_name_resources (WinLibrary *, WinResource *, int *);
 static WinResource *list_pe_resources (WinLibrary *, Win32ImageResourceDirectory *, int, int *);
-static int calc_vma_size (WinLibrary *);
-static void do_resources_recurs (WinLibrary *, WinResource *, WinResource *, WinResource *, WinResource *, char *, char *, char *, DoResourceCallback);
-static char *get_resource_id_quoted (WinResource *);
-static WinResource *find_with_resource_array(WinLibrary *, WinResource *, char *);
+static bool rva_to_offset (WinLibrary *, uint32_t, size_t *);
+static bool find_resource_table (WinLibrary *);
+static void index_resources_recurs (WinLibrary *, WinResource *, WinResourceEntry *, int *);
+static void add_resource_run (WinLibrary *, WinResource *, WinResource *, int);
+static uint32_t resource_id_hash (WinResource *);
+static int32_t resource_id_compare (WinResource *, WinResource *);
+static uint32_t resource_run_hash (WinResourceRun *);
+static int32_t resource_run_compare (WinResourceRun *, WinResourceRun *);
+static int find_resource_runs (WinLibrary *, ResourceIdQuery *, ResourceIdQuery *, WinResourceRun **);
+static int resource_id_candidates (ResourceIdQuery *, WinResource *);
+static ResourceIdQuery *parse_resource_id_query (char *, ResourceIdQuery *);
+static bool resource_entry_matches (WinResourceEntry *, ResourceIdQuery *, ResourceIdQuery *, ResourceIdQuery *);
+static void put_resource_id (JsonWriter *, const char *, WinResource *);
 static WinResource *list_resources (WinLibrary *fi, WinResource *res, int *count);
-static bool compare_resource_id (WinResource *wr, char *id);
+static bool resource_id_matches (WinResource *wr, ResourceIdQuery *query);
+
+/* what is each entry in this directory level for? type, name or language? */
+#define RESOURCE_HOLDER(e,x) ((x)==0 ? &(e)->type : ((x)==1 ? &(e)->name : &(e)->lang))
+
+/* the contents of an unused WinResource holder */
+static WinResource no_resource = { "", 0, NULL, NULL, 0, false, false, 0 };
+
+/* the quote to put around an id when listing it, if it is a string */
+#define RESOURCE_ID_QUOTE(wr) ((wr)->numeric_id || (wr)->id[0] == '\0' ? "" : "'")
+
+/* does the id of this entry match the specified id? */
+#define LEVEL_MATCHES(x) (x == NULL || ent->x.id[0] == '\0' || resource_id_matches(&ent->x, x))
 
 /* do_resources:
  *   Do something for each resource matching type, name and lang.
+ *   Returns the number of resources matched, or -1 if the callback
+ *   failed for any of them.
  */
 
-void
+int
 do_resources (WinLibrary *fi, char *type, char *name, char *lang, DoResourceCallback cb)
 {
-	WinResource *type_wr;
-	WinResource *name_wr;
-	WinResource *lang_wr;
+	WinResourceRun all = { NULL, NULL, 0, fi->entry_count };
+	WinResourceRun *runs[4];
+	ResourceIdQuery type_query, name_query, lang_query;
+	ResourceIdQuery *type_id, *name_id, *lang_id;
+	int c, d, runcnt, next, matched = 0;
+	bool success = true;
+
+	type_id = parse_resource_id_query(type, &type_query);
+	name_id = parse_resource_id_query(name, &name_query);
+	lang_id = parse_resource_id_query(lang, &lang_query);
+
+	/* narrow down the entries to look at using the index */
+	if (type_id == NULL) {
+		runs[0] = &all;
+		runcnt = 1;
+	} else {
+		runcnt = find_resource_runs(fi, type_id, name_id, runs);
+	}
 
-	type_wr = malloc(sizeof(WinResource)*3);
-	name_wr = type_wr + 1;
-	lang_wr = type_wr + 2;
-	memset(type_wr, 0, sizeof(WinResource)*3);
+	for (c = 0, next = 0 ; c < runcnt ; c++) {
+		for (d = MAX(runs[c]->first, next) ; d < runs[c]->first + runs[c]->count ; d++) {
+			WinResourceEntry *ent = fi->entries + d;
 
-	do_resources_recurs(fi, NULL, type_wr, name_wr, lang_wr, type, name, lang, cb);
+			if (resource_entry_matches(ent, type_id, name_id, lang_id)) {
+				if (!cb(fi, RESOURCE_HOLDER(ent, ent->level), &ent->type, &ent->name, &ent->lang))
+					success = false;
+				matched++;
+			}
+		}
+		next = MAX(next, d);
+	}
 
-	free(type_wr);
+	return success ? matched : -1;
 }
 
-/* what is each entry in this directory level for? type, name or language? */
-#define WINRESOURCE_BY_LEVEL(x) ((x)==0 ? type_wr : ((x)==1 ? name_wr : lang_wr))
+static bool
+resource_entry_matches (WinResourceEntry *ent, ResourceIdQuery *type, ResourceIdQuery *name, ResourceIdQuery *lang)
+{
+	return LEVEL_MATCHES(type) && LEVEL_MATCHES(name) && LEVEL_MATCHES(lang);
+}
 
-/* does the id of this entry match the specified id? */
-#define LEVEL_MATCHES(x) (x == NULL || x ## _wr->id[0] == '\0' || compare_resource_id(x ## _wr, x))
+/* find_resource_runs:
+ *   Look up the index runs possibly matching type (and name, unless
+ *   NULL), and store them in runs in the order they appear in the
+ *   resource table. Since a query may match both a numeric and a
+ *   string id, at most four runs are returned.
+ */
+static int
+find_resource_runs (WinLibrary *fi, ResourceIdQuery *type, ResourceIdQuery *name, WinResourceRun **runs)
+{
+	WinResource type_ids[2], name_ids[2];
+	int c, d, type_count, name_count, runcnt;
+
+	type_count = resource_id_candidates(type, type_ids);
+	name_count = (name == NULL ? 1 : resource_id_candidates(name, name_ids));
+
+	runcnt = 0;
+	for (c = 0 ; c < type_count ; c++) {
+		for (d = 0 ; d < name_count ; d++) {
+			WinResourceRun key = { type_ids+c, (name == NULL ? NULL : name_ids+d), 0, 0 };
+			WinResourceRun *run = hmap_get(fi->index, &key);
+			int e;
+
+			if (run == NULL)
+				continue;
+			for (e = runcnt ; e > 0 && runs[e-1]->first > run->first ; e--)
+				runs[e] = runs[e-1];
+			runs[e] = run;
+			runcnt++;
+		}
+	}
+
+	return runcnt;
+}
+
+/* resource_id_candidates:
+ *   Make the resource ids that may be matched by a query, to be
+ *   looked up in the index. Only the fields used by the index are set.
+ */
+static int
+resource_id_candidates (ResourceIdQuery *query, WinResource *wr)
+{
+	int count = 0;
+
+	if (query->numeric) {
+		wr[count].value = query->value;
+		wr[count].numeric_id = true;
+		count++;
+	}
+	if (query->string != NULL) {
+		wr[count].id = query->string;
+		wr[count].numeric_id = false;
+		count++;
+	}
+
+	return count;
+}
+
+/* parse_resource_id_query:
+ *   Parse an id specified on the command line into query. A leading
+ *   `+' makes it a string id only, and a leading `-' a numeric id
+ *   only. Returns NULL if id is NULL (any id matches), else query.
+ */
+static ResourceIdQuery *
+parse_resource_id_query (char *id, ResourceIdQuery *query)
+{
+	if (id == NULL)
+		return NULL;
+
+	query->numeric = (id[0] != '+' && parse_int32(id + (id[0] == '-' ? 1 : 0), &query->value));
+	query->string = (id[0] == '-' ? NULL : id + (id[0] == '+' ? 1 : 0));
+	return query;
+}
+
+static uint32_t
+resource_id_hash (WinResource *wr)
+{
+	return (wr->numeric_id ? (uint32_t) wr->value * 2 + 1 : strhash(wr->id) * 2);
+}
+
+static int32_t
+resource_id_compare (WinResource *wr1, WinResource *wr2)
+{
+	if (wr1->numeric_id != wr2->numeric_id)
+		return wr1->numeric_id - wr2->numeric_id;
+	if (wr1->numeric_id)
+		return (wr1->value > wr2->value) - (wr1->value < wr2->value);
+	return strcmp(wr1->id, wr2->id);
+}
+
+static uint32_t
+resource_run_hash (WinResourceRun *run)
+{
+	uint32_t hash = resource_id_hash(run->type);
+
+	if (run->name != NULL)
+		hash = hash * 31 + resource_id_hash(run->name);
+
+	return hash;
+}
+
+static int32_t
+resource_run_compare (WinResourceRun *r1, WinResourceRun *r2)
+{
+	int cmp;
+
+	if ((cmp = resource_id_compare(r1->type, r2->type)) != 0)
+		return cmp;
+	if (r1->name == NULL || r2->name == NULL)
+		return (r1->name != NULL) - (r2->name != NULL);
+	return resource_id_compare(r1->name, r2->name);
+}
 
+/* index_resources_recurs:
+ *   Add all resources below base to the library index, in the order
+ *   they appear in the resource table. Resource tables have at most
+ *   three levels, deeper directories are ignored.
+ */
 static void
-do_resources_recurs (WinLibrary *fi, WinResource *base, WinResource *type_wr,
-                          WinResource *name_wr, WinResource *lang_wr,
-						  char *type, char *name, char *lang, DoResourceCallback cb)
+index_resources_recurs (WinLibrary *fi, WinResource *base, WinResourceEntry *holder, int *capacity)
 {
 	int c, rescnt;
 	WinResource *wr;
@@ -81,88 +266,146 @@ do_resources_recurs (WinLibrary *fi, WinResource *base, WinResource *type_wr,
 	if (wr == NULL)
 		return;
 
-	/* process each resource listed */
 	for (c = 0 ; c < rescnt ; c++) {
 		/* (over)write the corresponding WinResource holder with the current */
-		memcpy(WINRESOURCE_BY_LEVEL(wr[c].level), wr+c, sizeof(WinResource));
-
-		/* go deeper unless there is something that does NOT match */
-		if (LEVEL_MATCHES(type) && LEVEL_MATCHES(name) && LEVEL_MATCHES(lang)) {
-			if (wr->is_directory)
-				do_resources_recurs (fi, wr+c, type_wr, name_wr, lang_wr, type, name, lang, cb);
-			else
-				cb(fi, wr+c, type_wr, name_wr, lang_wr);
+		memcpy(RESOURCE_HOLDER(holder, wr[c].level), wr+c, sizeof(WinResource));
+
+		if (wr[c].is_directory) {
+			if (wr[c].level < 2)
+				index_resources_recurs (fi, wr+c, holder, capacity);
+		} else {
+			if (fi->entry_count >= *capacity) {
+				*capacity = MAX(16, *capacity * 2);
+				fi->entries = xrealloc(fi->entries, *capacity * sizeof(WinResourceEntry));
+			}
+			holder->level = wr[c].level;
+			memcpy(fi->entries + fi->entry_count, holder, sizeof(WinResourceEntry));
+			fi->entry_count++;
 		}
 	}
 
 	/* since we're moving back one level after this, unset the
 	 * WinResource holder used on this level */
-	memset(WINRESOURCE_BY_LEVEL(wr[0].level), 0, sizeof(WinResource));
+	if (rescnt > 0)
+		memcpy(RESOURCE_HOLDER(holder, wr[0].level), &no_resource, sizeof(WinResource));
+}
+
+static void
+add_resource_run (WinLibrary *fi, WinResource *type, WinResource *name, int entry)
+{
+	WinResourceRun key = { type, name, 0, 0 };
+	WinResourceRun *run;
+
+	run = hmap_get(fi->index, &key);
+	if (run == NULL) {
+		run = arena_alloc(fi->arena, sizeof(WinResourceRun));
+		memcpy(run, &key, sizeof(WinResourceRun));
+		run->first = entry;
+		hmap_put(fi->index, run, run);
+	}
+	run->count = entry - run->first + 1;
 }
 
+/* free_library_index:
+ *   Free the resource index built by read_library.
+ */
 void
+free_library_index (WinLibrary *fi)
+{
+	if (fi->index != NULL) {
+		hmap_free(fi->index);
+		fi->index = NULL;
+	}
+	free(fi->entries);
+	fi->entries = NULL;
+	fi->entry_count = 0;
+}
+
+bool
 print_resources_callback (WinLibrary *fi, WinResource *wr,
                           WinResource *type_wr, WinResource *name_wr,
 						  WinResource *lang_wr)
 {
 	char *type, *offset;
-	int32_t id, size;
+	size_t size;
+	uint32_t address;
 
 	/* get named resource type if possible */
 	type = NULL;
-	if (parse_int32(type_wr->id, &id))
-		type = res_type_id_to_string(id);
+	if (type_wr->numeric_id)
+		type = res_type_id_to_string(type_wr->value);
 
 	/* get offset and size info on resource */
 	offset = get_resource_entry(fi, wr, &size);
 	if (offset == NULL)
-		return;
+		return false;
+
+	/* show the virtual address for PE resources, the file offset for NE */
+	if (fi->is_PE_binary)
+		address = ((Win32ImageResourceDataEntry *) wr->children)->offset_to_data;
+	else
+		address = (uint32_t) (offset - fi->memory);
+
+	if (json_output != NULL) {
+		json_writer_begin(json_output);
+		json_writer_string(json_output, "file", fi->name);
+		put_resource_id(json_output, "type", type_wr);
+		put_resource_id(json_output, "name", name_wr);
+		put_resource_id(json_output, "lang", lang_wr);
+		json_writer_uint(json_output, "offset", address);
+		json_writer_uint(json_output, "size", size);
+		json_writer_end(json_output);
+		return true;
+	}
 
-	printf(_("--type=%s --name=%s%s%s [%s%s%soffset=0x%x size=%d]\n"),
-	  get_resource_id_quoted(type_wr),
-	  get_resource_id_quoted(name_wr),
+	/* string ids are quoted in place, so that listing a library kept
+	 * open by --batch does not allocate from its arena */
+	printf(_("--type=%s%s%s --name=%s%s%s%s%s%s%s [%s%s%soffset=0x%x size=%lu]\n"),
+	  RESOURCE_ID_QUOTE(type_wr), type_wr->id, RESOURCE_ID_QUOTE(type_wr),
+	  RESOURCE_ID_QUOTE(name_wr), name_wr->id, RESOURCE_ID_QUOTE(name_wr),
 	  (lang_wr->id[0] != '\0' ? _(" --language=") : ""),
-	  get_resource_id_quoted(lang_wr),
+	  RESOURCE_ID_QUOTE(lang_wr), lang_wr->id, RESOURCE_ID_QUOTE(lang_wr),
 	  (type != NULL ? "type=" : ""),
 	  (type != NULL ? type : ""),
 	  (type != NULL ? " " : ""),
-	  (uint32_t) (offset - fi->memory), size);
+	  address, (unsigned long) size);
+	return true;
 }
 
-/* return the resource id quoted if it's a string, otherwise just return it */
-static char *
-get_resource_id_quoted (WinResource *wr)
+/* put_resource_id:
+ *   Add a resource id to a JSON record, as a number if it is numeric
+ *   and null if there is none (the language of NE resources).
+ */
+static void
+put_resource_id (JsonWriter *writer, const char *key, WinResource *wr)
 {
-	static char tmp[WINRES_ID_MAXLEN+2];
-
-	if (wr->numeric_id || wr->id[0] == '\0')
-		return wr->id;
-
-	sprintf(tmp, "'%s'", wr->id);
-	return tmp;
+	if (wr->id[0] == '\0')
+		json_writer_null(writer, key);
+	else if (wr->numeric_id)
+		json_writer_int(writer, key, wr->value);
+	else
+		json_writer_string(writer, key, wr->id);
 }
 
 static bool
-compare_resource_id (WinResource *wr, char *id)
+resource_id_matches (WinResource *wr, ResourceIdQuery *query)
 {
-	if (wr->numeric_id) {
-		int32_t cmp1, cmp2;
-		if (id[0] == '+')
-			return false;
-		if (id[0] == '-')
-			id++;
-		if (!parse_int32(wr->id, &cmp1) || !parse_int32(id, &cmp2) || cmp1 != cmp2)
-			return false;
-	} else {
-		if (id[0] == '-')
-			return false;
-		if (id[0] == '+')
-			id++;
-		if (strcmp(wr->id, id))
-			return false;
-	}
+	if (wr->numeric_id)
+		return query->numeric && wr->value == query->value;
+	return query->string != NULL && strcmp(wr->id, query->string) == 0;
+}
 
-	return true;
+/* set_numeric_resource_id:
+ *   Store a numeric resource id in wr, together with its string form.
+ */
+static void
+set_numeric_resource_id (WinLibrary *fi, WinResource *wr, int32_t value)
+{
+	char tmp[INT_BUFSIZE_BOUND(int32_t)];
+
+	wr->value = value;
+	wr->id_len = sprintf(tmp, "%d", value);
+	wr->id = arena_strndup(fi->arena, tmp, wr->id_len);
 }
 
 static bool
@@ -178,13 +421,15 @@ decode_pe_resource_id (WinLibrary *fi, WinResource *wr, uint32_t value)
 		len = mem[0];
 		RETURN_IF_BAD_OFFSET(false, &mem[1], sizeof(uint16_t) * len);
 
-		len = MIN(mem[0], WINRES_ID_MAXLEN);
+		wr->id = arena_alloc(fi->arena, len + 1);
+		wr->id_len = len;
+		wr->value = 0;
 		for (c = 0 ; c < len ; c++)
 			wr->id[c] = mem[c+1] & 0x00FF;
 		wr->id[len] = '\0';
 	} else {					/* Unicode string id */
 		/* translate id into a string */
-		snprintf(wr->id, WINRES_ID_MAXLEN, "%d", value);
+		set_numeric_resource_id(fi, wr, value);
 	}
 
 	wr->numeric_id = (value & IMAGE_RESOURCE_NAME_IS_STRING ? false:true);
@@ -192,28 +437,49 @@ decode_pe_resource_id (WinLibrary *fi, WinResource *wr, uint32_t value)
 }
  
 void *
-get_resource_entry (WinLibrary *fi, WinResource *wr, int *size)
+get_resource_entry (WinLibrary *fi, WinResource *wr, size_t *size)
 {
+	size_t offset;
+
 	if (fi->is_PE_binary) {
 		Win32ImageResourceDataEntry *dataent;
 
 		dataent = (Win32ImageResourceDataEntry *) wr->children;
 		RETURN_IF_BAD_POINTER(NULL, *dataent);
 		*size = dataent->size;
-		RETURN_IF_BAD_OFFSET(NULL, fi->memory + dataent->offset_to_data, *size);
-
-		return fi->memory + dataent->offset_to_data;
+		if (!rva_to_offset(fi, dataent->offset_to_data, &offset)) {
+			warn(_("%s: premature end"), fi->name);
+			return NULL;
+		}
 	} else {
 		Win16NENameInfo *nameinfo;
-		int sizeshift;
+		uint16_t sizeshift;
+		uint64_t ne_offset, ne_size;
 
 		nameinfo = (Win16NENameInfo *) wr->children;
 		sizeshift = *((uint16_t *) fi->first_resource - 1);
-		*size = nameinfo->length << sizeshift;
-		RETURN_IF_BAD_OFFSET(NULL, fi->memory + (nameinfo->offset << sizeshift), *size);
+		/* 16-bit units shifted by more than 32 are beyond any file */
+		if (sizeshift > 32) {
+			warn(_("%s: premature end"), fi->name);
+			return NULL;
+		}
+		ne_offset = (uint64_t) nameinfo->offset << sizeshift;
+		ne_size = (uint64_t) nameinfo->length << sizeshift;
+		if (ne_offset > fi->total_size || ne_size > fi->total_size - ne_offset) {
+			warn(_("%s: premature end"), fi->name);
+			return NULL;
+		}
+		offset = ne_offset;
+		*size = ne_size;
+	}
 
-		return fi->memory + (nameinfo->offset << sizeshift);
+	/* check against the file size before forming the pointer */
+	if (offset > fi->total_size) {
+		warn(_("%s: premature end"), fi->name);
+		return NULL;
 	}
+	RETURN_IF_BAD_OFFSET(NULL, fi->memory + offset, *size);
+	return fi->memory + offset;
 }
 
 static bool
@@ -221,7 +487,7 @@ decode_ne_resource_id (WinLibrary *fi, WinResource *wr, uint16_t value)
 {
 	if (value & NE_RESOURCE_NAME_IS_NUMERIC) {		/* numeric id */
 		/* translate id into a string */
-		snprintf(wr->id, WINRES_ID_MAXLEN, "%d", value & ~NE_RESOURCE_NAME_IS_NUMERIC);
+		set_numeric_resource_id(fi, wr, value & ~NE_RESOURCE_NAME_IS_NUMERIC);
 	} else {					/* ASCII string id */
 		int len;
 		char *mem = (char *) NE_HEADER(fi->memory)
@@ -232,8 +498,9 @@ decode_ne_resource_id (WinLibrary *fi, WinResource *wr, uint16_t value)
 		RETURN_IF_BAD_POINTER(false, *mem);
 		len = mem[0];
 		RETURN_IF_BAD_OFFSET(false, &mem[1], sizeof(char) * len);
-		memcpy(wr->id, &mem[1], len);
-		wr->id[len] = '\0';
+		wr->id = arena_strndup(fi->arena, &mem[1], len);
+		wr->id_len = len;
+		wr->value = 0;
 	}
 
 	wr->numeric_id = (value & NE_RESOURCE_NAME_IS_NUMERIC ? true:false);
@@ -249,12 +516,13 @@ list_pe_resources (WinLibrary *fi, Win32ImageResourceDirectory *pe_res, int leve
 	  = (Win32ImageResourceDirectoryEntry *) (pe_res + 1);
 
 	/* count number of `type' resources */
+	RETURN_IF_BAD_POINTER(NULL, *pe_res);
 	RETURN_IF_BAD_POINTER(NULL, *dirent);
 	rescnt = pe_res->number_of_named_entries + pe_res->number_of_id_entries;
 	*count = rescnt;
 
 	/* allocate WinResource's */
-	wr = xmalloc(sizeof(WinResource) * rescnt);
+	wr = arena_alloc(fi->arena, sizeof(WinResource) * rescnt);
 
 	/* fill in the WinResource's */
 	for (c = 0 ; c < rescnt ; c++) {
@@ -285,7 +553,7 @@ list_ne_name_resources (WinLibrary *fi, WinResource *typeres, int *count)
 	*count = rescnt = typeinfo->count;
 
 	/* allocate WinResource's */
-	wr = xmalloc(sizeof(WinResource) * rescnt);
+	wr = arena_alloc(fi->arena, sizeof(WinResource) * rescnt);
 
 	/* fill in the WinResource's */
 	for (c = 0 ; c < rescnt ; c++) {
@@ -324,7 +592,7 @@ list_ne_type_resources (WinLibrary *fi, int *count)
 	*count = rescnt;
 
 	/* allocate WinResource's */
-	wr = xmalloc(sizeof(WinResource) * rescnt);
+	wr = arena_alloc(fi->arena, sizeof(WinResource) * rescnt);
 
 	/* fill in the WinResource's */
 	typeinfo = (Win16NETypeInfo *) fi->first_resource;
@@ -369,10 +637,42 @@ list_resources (WinLibrary *fi, WinResource *res, int *count)
 /* read_library:
  *
  * Read header and get resource directory offset in a Windows library
- * (AKA module).
+ * (AKA module), then index all resources in it.
  */
 bool
 read_library (WinLibrary *fi)
+{
+	int capacity = 0;
+	WinResourceEntry holder;
+	int c;
+
+	fi->entries = NULL;
+	fi->entry_count = 0;
+	fi->index = NULL;
+
+	if (!find_resource_table(fi)) {
+		/* error reported by find_resource_table */
+		return false;
+	}
+
+	holder.type = holder.name = holder.lang = no_resource;
+	holder.level = 0;
+	index_resources_recurs(fi, NULL, &holder, &capacity);
+
+	fi->index = hmap_new();
+	hmap_set_hash_fn(fi->index, (hash_fn_t) resource_run_hash);
+	hmap_set_compare_fn(fi->index, (comparison_fn_t) resource_run_compare);
+	for (c = 0 ; c < fi->entry_count ; c++) {
+		add_resource_run(fi, &fi->entries[c].type, NULL, c);
+		if (fi->entries[c].level >= 1)
+			add_resource_run(fi, &fi->entries[c].type, &fi->entries[c].name, c);
+	}
+
+	return true;
+}
+
+static bool
+find_resource_table (WinLibrary *fi)
 {
 	/* check for DOS header signature `MZ' */
 	RETURN_IF_BAD_POINTER(false, MZ_HEADER(fi->memory)->magic);
@@ -381,7 +681,8 @@ read_library (WinLibrary *fi)
 
 		RETURN_IF_BAD_POINTER(false, mz_header->lfanew);
 		if (mz_header->lfanew < sizeof (DOSImageHeader)) {
-			warn(_("%s: not a PE or NE library"), fi->name);
+			if (!arg_quiet_non_pe)
+				warn(_("%s: not a PE or NE library"), fi->name);
 			return false;
 		}
 
@@ -403,6 +704,7 @@ read_library (WinLibrary *fi)
 
 		fi->is_PE_binary = false;
 		alignshift = (uint16_t *) ((uint8_t *) NE_HEADER(fi->memory) + header->rsrctab);
+		RETURN_IF_BAD_POINTER(false, *alignshift);
 		fi->first_resource = ((uint8_t *) alignshift) + sizeof(uint16_t);
 		RETURN_IF_BAD_POINTER(false, *(Win16NETypeInfo *) fi->first_resource);
 
@@ -412,143 +714,141 @@ read_library (WinLibrary *fi)
 	/* check for NT header signature `PE' */
 	RETURN_IF_BAD_POINTER(false, PE_HEADER(fi->memory)->signature);
 	if (PE_HEADER(fi->memory)->signature == IMAGE_NT_SIGNATURE) {
-		Win32ImageSectionHeader *pe_sec;
 		Win32ImageDataDirectory *dir;
 		Win32ImageNTHeaders *pe_header;
-		int d;
+		uint32_t dir_count;
+		size_t dir_end, offset;
 
-		/* allocate new memory */
-		fi->total_size = calc_vma_size(fi);
-		if (fi->total_size == 0) {
-			/* calc_vma_size has reported error */
-			return false;
-		}
-		fi->memory = xrealloc(fi->memory, fi->total_size);
-
-		/* relocate memory, start from last section */
+		/* locate the section table, used to translate addresses */
 		pe_header = PE_HEADER(fi->memory);
 		RETURN_IF_BAD_POINTER(false, pe_header->file_header.number_of_sections);
-
-		/* we don't need to do OFFSET checking for the sections.
-		 * calc_vma_size has already done that */
-		for (d = pe_header->file_header.number_of_sections - 1; d >= 0 ; d--) {
-			pe_sec = PE_SECTIONS(fi->memory) + d;
-
-	            	if (pe_sec->characteristics & IMAGE_SCN_CNT_UNINITIALIZED_DATA)
-			    continue;
-
-    	    	    	//if (pe_sec->virtual_address + pe_sec->size_of_raw_data > fi->total_size)
-
-    	    	    	RETURN_IF_BAD_OFFSET(0, fi->memory + pe_sec->virtual_address, pe_sec->size_of_raw_data);
-    	    	    	RETURN_IF_BAD_OFFSET(0, fi->memory + pe_sec->pointer_to_raw_data, pe_sec->size_of_raw_data);
-    	    	    	if (pe_sec->virtual_address != pe_sec->pointer_to_raw_data) {
-    	    	    	    memmove(fi->memory + pe_sec->virtual_address,
-				    fi->memory + pe_sec->pointer_to_raw_data,
-				    pe_sec->size_of_raw_data);
-			}
+		fi->sections = PE_SECTIONS(fi->memory);
+		fi->section_count = pe_header->file_header.number_of_sections;
+		RETURN_IF_BAD_OFFSET(false, fi->sections, sizeof(Win32ImageSectionHeader) * fi->section_count);
+
+		/* the data directories follow an optional header whose layout
+		 * depends on whether this is a PE32 or a PE32+ image */
+		RETURN_IF_BAD_POINTER(false, pe_header->optional_header.magic);
+		switch (pe_header->optional_header.magic) {
+		case IMAGE_NT_OPTIONAL_HDR32_MAGIC: {
+			Win32ImageOptionalHeader *opt32 = &pe_header->optional_header;
+
+			RETURN_IF_BAD_POINTER(false, opt32->number_of_rva_and_sizes);
+			dir_count = opt32->number_of_rva_and_sizes;
+			dir = opt32->data_directory;
+			dir_end = offsetof(Win32ImageOptionalHeader, data_directory);
+			break;
+		}
+		case IMAGE_NT_OPTIONAL_HDR64_MAGIC: {
+			Win32ImageOptionalHeader64 *opt64 = (Win32ImageOptionalHeader64 *) &pe_header->optional_header;
+
+			RETURN_IF_BAD_POINTER(false, opt64->number_of_rva_and_sizes);
+			dir_count = opt64->number_of_rva_and_sizes;
+			dir = opt64->data_directory;
+			dir_end = offsetof(Win32ImageOptionalHeader64, data_directory);
+			break;
+		}
+		default:
+			warn(_("%s: unknown optional header type 0x%x"), fi->name, pe_header->optional_header.magic);
+			return false;
 		}
 
 		/* find resource directory */
-		RETURN_IF_BAD_POINTER(false, pe_header->optional_header.data_directory[IMAGE_DIRECTORY_ENTRY_RESOURCE]);
-		dir = pe_header->optional_header.data_directory + IMAGE_DIRECTORY_ENTRY_RESOURCE;
+		dir += IMAGE_DIRECTORY_ENTRY_RESOURCE;
+		dir_end += (IMAGE_DIRECTORY_ENTRY_RESOURCE + 1) * sizeof(Win32ImageDataDirectory);
+		if (dir_count <= IMAGE_DIRECTORY_ENTRY_RESOURCE
+		    || dir_end > pe_header->file_header.size_of_optional_header) {
+			warn(_("%s: file contains no resources"), fi->name);
+			return false;
+		}
+		RETURN_IF_BAD_POINTER(false, *dir);
 		if (dir->size == 0) {
 			warn(_("%s: file contains no resources"), fi->name);
 			return false;
 		}
 
-		fi->first_resource = ((uint8_t *) fi->memory) + dir->virtual_address;
+		if (!rva_to_offset(fi, dir->virtual_address, &offset) || offset > fi->total_size) {
+			warn(_("%s: premature end"), fi->name);
+			return false;
+		}
+		/* the whole resource directory is usually looked at */
+		prefetch_library(fi, offset, dir->size);
+		fi->first_resource = ((uint8_t *) fi->memory) + offset;
+		RETURN_IF_BAD_POINTER(false, *(Win32ImageResourceDirectory *) fi->first_resource);
 		fi->is_PE_binary = true;
 		return true;
 	}
 
 	/* other (unknown) header signature was found */
-	warn(_("%s: not a PE or NE library"), fi->name);
+	if (!arg_quiet_non_pe)
+		warn(_("%s: not a PE or NE library"), fi->name);
 	return false;
 }
 
-/* calc_vma_size:
- *   Calculate the total amount of memory needed for a 32-bit Windows
- *   module. Returns -1 if file was too small.
+/* rva_to_offset:
+ *   Translate a relative virtual address of a 32-bit Windows module
+ *   to an offset in the file, using the section table. Addresses
+ *   below the first section refer to the headers, which are loaded
+ *   as they are found in the file. Returns false if the address does
+ *   not refer to data present in the file.
  */
-static int
-calc_vma_size (WinLibrary *fi)
+static bool
+rva_to_offset (WinLibrary *fi, uint32_t rva, size_t *offset)
 {
     Win32ImageSectionHeader *seg;
-    int c, segcount, size;
-
-    size = 0;
-    RETURN_IF_BAD_POINTER(-1, PE_HEADER(fi->memory)->file_header.number_of_sections);
-    segcount = PE_HEADER(fi->memory)->file_header.number_of_sections;
-
-    /* If there are no segments, just process file like it is.
-     * This is (probably) not the right thing to do, but problems
-     * will be delt with later anyway.
-     */
-    if (segcount == 0)
-    	return fi->total_size;
-
-    seg = PE_SECTIONS(fi->memory);
-    RETURN_IF_BAD_POINTER(-1, *seg);
-    
-    for (c = 0 ; c < segcount ; c++) {
-    	RETURN_IF_BAD_POINTER(0, *seg);
-
-    	size = MAX(size, seg->virtual_address + seg->size_of_raw_data);
-		/* I have no idea what misc.virtual_size is for... */
-        size = MAX(size, seg->virtual_address + seg->misc.virtual_size);
-        seg++;
+    uint32_t lowest_address = UINT32_MAX;
+    int c;
+
+    for (c = 0 ; c < fi->section_count ; c++) {
+    	seg = fi->sections + c;
+    	if (seg->characteristics & IMAGE_SCN_CNT_UNINITIALIZED_DATA)
+    	    continue;
+
+    	lowest_address = MIN(lowest_address, seg->virtual_address);
+    	if (rva >= seg->virtual_address && rva - seg->virtual_address < seg->size_of_raw_data) {
+    	    /* the sum may not fit in 32 bits */
+    	    uint64_t pos = (uint64_t) seg->pointer_to_raw_data + (rva - seg->virtual_address);
+
+    	    if (pos > fi->total_size)
+    	    	return false;
+    	    *offset = pos;
+    	    return true;
+    	}
     }
 
-    return size;
+    if (rva < lowest_address) {
+    	*offset = rva;
+    	return true;
+    }
+
+    return false;
 }
 
-static WinResource *
-find_with_resource_array(WinLibrary *fi, WinResource *wr, char *id)
+/* find_resource:
+ *   Find the resource with the specified numeric type and name, in
+ *   the language of lang if it is not NULL and the library has a
+ *   language level.
+ */
+WinResource *
+find_resource (WinLibrary *fi, int32_t type, int32_t name, WinResource *lang)
 {
-	int c, rescnt;
-	WinResource *return_wr;
+	ResourceIdQuery type_id = { true, type, NULL };
+	ResourceIdQuery name_id = { true, name, NULL };
+	WinResourceRun *run;
 
-	wr = list_resources(fi, wr, &rescnt);
-	if (wr == NULL)
-		return NULL;
+	/* the numeric ids can only be in a single run */
+	if (find_resource_runs(fi, &type_id, &name_id, &run) == 1) {
+		int d;
 
-	for (c = 0 ; c < rescnt ; c++) {
-		if (compare_resource_id (&wr[c], id)) {
-			/* duplicate WinResource and return it */
-			return_wr = xmalloc(sizeof(WinResource));
-			memcpy(return_wr, &wr[c], sizeof(WinResource));
-
-			/* free old WinResource */
-			free(wr);
-			return return_wr;
+		for (d = run->first ; d < run->first + run->count ; d++) {
+			WinResourceEntry *ent = fi->entries + d;
+
+			if (!resource_id_matches(&ent->type, &type_id) || !resource_id_matches(&ent->name, &name_id))
+				continue;
+			if (ent->level < 2 || lang == NULL || lang->id[0] == '\0' || resource_id_compare(&ent->lang, lang) == 0)
+				return RESOURCE_HOLDER(ent, ent->level);
 		}
 	}
 
 	return NULL;
 }
-
-WinResource *
-find_resource (WinLibrary *fi, char *type, char *name, char *language, int *level)
-{
-	WinResource *wr;
-
-	*level = 0;
-	if (type == NULL)
-		return NULL;
-	wr = find_with_resource_array(fi, NULL, type);
-	if (wr == NULL || !wr->is_directory)
-		return wr;
-
-	*level = 1;
-	if (name == NULL)
-		return wr;
-	wr = find_with_resource_array(fi, wr, name);
-	if (wr == NULL || !wr->is_directory)
-		return wr;
-
-	*level = 2;
-	if (language == NULL)
-		return wr;
-	wr = find_with_resource_array(fi, wr, language);
-	return wr;
-}
@@ -0,0 +1,356 @@
+/* script.c - Extract resources listed in resource scripts
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <sys/stat.h>			/* POSIX */
+#include "gettext.h"			/* Gnulib */
+#define _(s) gettext(s)
+#define N_(s) gettext_noop(s)
+#include "xalloc.h"			/* Gnulib */
+#include "xvasprintf.h"			/* Gnulib */
+#include "common/error.h"
+#include "common/hmap.h"
+#include "common/intutil.h"
+#include "common/jobs.h"
+#include "common/llist.h"
+#include "common/string-utils.h"
+#include "icotool.h"
+#include "wrestool.h"
+
+/* highest version of resource scripts understood */
+#define SCRIPT_VERSION 1
+#define WHITESPACE " \t\r\n"
+
+typedef struct {
+	char *type;
+	char *name;
+	char *lang;
+	char *dest;
+} ScriptResource;
+
+/* A binary and all resources to extract from it, in the order they
+ * appear in the script. */
+typedef struct {
+	char *name;
+	LList *resources;
+} ScriptFile;
+
+static char *script_destination;
+static int script_matches;
+static Arena *script_arena;
+
+/* parse_resource:
+ *   Parse the parameter of a resource statement, `TYPE, NAME[, LANG]:
+ *   DEST'. The destination is placed in the output directory if one
+ *   was specified. Returns NULL if the type, name or destination is
+ *   missing.
+ */
+static ScriptResource *
+parse_resource (char *param, char *output)
+{
+	ScriptResource *res;
+	char *fields[3];
+	char *dest;
+	int c;
+
+	dest = strchr(param, ':');
+	if (dest == NULL)
+		return NULL;
+	*dest++ = '\0';
+	string_strip_leading(dest, WHITESPACE);
+	string_split_c(param, ',', fields, 3);
+	for (c = 0 ; c < 3 ; c++) {
+		if (fields[c] != NULL) {
+			string_strip_leading(fields[c], WHITESPACE);
+			string_strip_trailing(fields[c], WHITESPACE);
+		}
+	}
+	if (fields[0][0] == '\0' || fields[1] == NULL || fields[1][0] == '\0' || dest[0] == '\0')
+		return NULL;
+
+	res = xmalloc(sizeof(ScriptResource));
+	res->type = xstrdup(fields[0]);
+	res->name = xstrdup(fields[1]);
+	res->lang = (fields[2] == NULL || fields[2][0] == '\0' ? NULL : xstrdup(fields[2]));
+	if (output == NULL)
+		res->dest = xstrdup(dest);
+	else
+		res->dest = xasprintf("%s%s%s", output, (ends_with(output, "/") ? "" : "/"), dest);
+	return res;
+}
+
+/* parse_script:
+ *   Read a resource script, adding the binaries it names to files.
+ *   Resources listed under the same binary in different places of
+ *   the script are merged. Returns false if the script could not be
+ *   read (problems with single statements are only warned about).
+ */
+static bool
+parse_script (char *filename, char *output, LList *files)
+{
+	HMap *file_map;
+	ScriptFile *current = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	bool success = true;
+	FILE *in;
+
+	in = fopen(filename, "r");
+	if (in == NULL) {
+		warn_errno("%s", filename);
+		return false;
+	}
+
+	file_map = hmap_new();
+	while (getline(&line, &size, in) >= 0) {
+		char *keyword, *param;
+
+		lineno++;
+		string_strip_leading(line, WHITESPACE);
+		string_strip_trailing(line, WHITESPACE);
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		/* split line into keyword and parameter */
+		keyword = line;
+		param = line + strcspn(line, WHITESPACE);
+		if (*param != '\0') {
+			*param++ = '\0';
+			param += strspn(param, WHITESPACE);
+		}
+		if (*param == '\0') {
+			warn(_("%s: missing parameter in `%s' statement in line %d"), filename, keyword, lineno);
+			continue;
+		}
+
+		if (strcmp(keyword, "version") == 0) {
+			int32_t version;
+
+			if (!parse_int32(param, &version) || version > SCRIPT_VERSION) {
+				warn(_("%s: resource script version `%s' not supported"), filename, param);
+				success = false;
+				break;
+			}
+		} else if (strcmp(keyword, "file") == 0) {
+			current = hmap_get(file_map, param);
+			if (current == NULL) {
+				current = xmalloc(sizeof(ScriptFile));
+				current->name = xstrdup(param);
+				current->resources = llist_new();
+				hmap_put(file_map, current->name, current);
+				llist_add(files, current);
+			}
+		} else if (strcmp(keyword, "resource") == 0) {
+			ScriptResource *res;
+
+			if (current == NULL) {
+				warn(_("%s: `resource' statement before `file' in line %d"), filename, lineno);
+				continue;
+			}
+			res = parse_resource(param, output);
+			if (res == NULL) {
+				warn(_("%s: missing parameter in `%s' statement in line %d"), filename, keyword, lineno);
+				continue;
+			}
+			llist_add(current->resources, res);
+		} else {
+			warn(_("%s: invalid keyword `%s' in line %d"), filename, keyword, lineno);
+		}
+	}
+	if (ferror(in)) {
+		warn_errno("%s", filename);
+		success = false;
+	}
+
+	free(line);
+	hmap_free(file_map);
+	fclose(in);
+	return success;
+}
+
+static void
+free_script_file (ScriptFile *file)
+{
+	LListIterator it;
+
+	for (llist_iterator(file->resources, &it); it.has_next(&it); ) {
+		ScriptResource *res = it.next(&it);
+
+		free(res->type);
+		free(res->name);
+		free(res->lang);
+		free(res->dest);
+		free(res);
+	}
+	llist_free(file->resources);
+	free(file->name);
+	free(file);
+}
+
+/* make_directories:
+ *   Create the directories leading to a file, if they do not exist.
+ */
+static void
+make_directories (const char *path)
+{
+	char *dir = xstrdup(path);
+	char *p;
+
+	for (p = strchr(dir + 1, '/') ; p != NULL ; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		/* errors are reported when the file is created */
+		mkdir(dir, 0777);
+		*p = '/';
+	}
+	free(dir);
+}
+
+static bool
+script_filter (UNUSED int index, UNUSED int width, UNUSED int height, UNUSED int bitdepth, UNUSED int palettesize, UNUSED bool icon, UNUSED int hotspot_x, UNUSED int hotspot_y)
+{
+	return true;
+}
+
+/* script_outfile_gen:
+ *   Write every image to the destination of the resource, as
+ *   `icotool -x -o DEST' does.
+ */
+static FILE *
+script_outfile_gen (char **outname_ptr, UNUSED int width, UNUSED int height, UNUSED int bit_count, UNUSED int index)
+{
+	*outname_ptr = xstrdup(script_destination);
+	return fopen(script_destination, "wb");
+}
+
+/* extract_script_resource_callback:
+ *   Write a resource to the current destination. Icons and cursors
+ *   are converted to PNG like `wrestool -x | icotool -x -o DEST -'
+ *   in extresso, other resources are written like `wrestool -x -o
+ *   DEST'. Only the first of several matching languages is written,
+ *   since they would all go to the same destination.
+ */
+static bool
+extract_script_resource_callback (WinLibrary *fi, WinResource *wr,
+                                  WinResource *type_wr, UNUSED WinResource *name_wr,
+                                  WinResource *lang_wr)
+{
+	ExtractedResource res;
+	bool success = false;
+	FILE *out;
+
+	if (script_matches++ > 0)
+		return true;
+	if (!extract_resource(fi, wr, type_wr, lang_wr, false, &res)) {
+		/* extract resource has printed error */
+		return false;
+	}
+
+	if (is_group_icon_cursor_type(type_wr)) {
+		bool free_it;
+		void *memory = extracted_resource_data(&res, &free_it);
+
+		success = extract_icons_from_memory(memory, res.size, fi->name, false, script_outfile_gen, script_filter, 1) != -1;
+		if (free_it)
+			free(memory);
+	} else {
+		out = fopen(script_destination, "wb");
+		if (out == NULL) {
+			warn_errno("%s", script_destination);
+		} else {
+			if (!write_extracted_resource(fi, &res, out))
+				warn_errno("%s", script_destination);
+			else
+				success = true;
+			fclose(out);
+		}
+	}
+
+	free_extracted_resource(&res);
+	return success;
+}
+
+/* process_script_file:
+ *   Extract the resources listed for a binary, reading it only once.
+ *   This is run as a job, possibly in a worker process of its own.
+ */
+static int
+process_script_file (void *data)
+{
+	ScriptFile *file = data;
+	LListIterator it;
+	WinLibrary fi;
+	int status, failures = 0;
+
+	status = open_library(&fi, file->name, script_arena);
+	if (status <= 0) {
+		if (status < 0)
+			warn_errno("%s", file->name);
+		close_library(&fi);
+		return 1;
+	}
+
+	for (llist_iterator(file->resources, &it); it.has_next(&it); ) {
+		ScriptResource *res = it.next(&it);
+		int matched;
+
+		script_destination = res->dest;
+		script_matches = 0;
+		make_directories(res->dest);
+		matched = do_resources(&fi, res_type_string_to_id(res->type), res->name, res->lang, extract_script_resource_callback);
+		if (matched == 0)
+			warn(_("%s: no resource of type `%s' named `%s'"), file->name, res->type, res->name);
+		if (script_matches > 1)
+			warn(_("%s: more than one resource of type `%s' named `%s', only the first is extracted to %s"), file->name, res->type, res->name, res->dest);
+		if (matched <= 0)
+			failures++;
+	}
+
+	close_library(&fi);
+	return failures > 0;
+}
+
+/* run_script:
+ *   Extract the resources listed in a resource script, placing them
+ *   in the output directory if not NULL. Up to jobs binaries are
+ *   processed at the same time. Returns false if the script could
+ *   not be read or any resource could not be extracted.
+ */
+bool
+run_script (char *filename, char *output, int jobs)
+{
+	LList *files;
+	LListIterator it;
+	JobPool *pool;
+	bool success;
+
+	files = llist_new();
+	success = parse_script(filename, output, files);
+	if (success) {
+		script_arena = arena_new(16384);
+		pool = job_pool_new(jobs);
+		for (llist_iterator(files, &it); it.has_next(&it); )
+			job_pool_submit(pool, process_script_file, it.next(&it));
+		success = job_pool_finish(pool);
+		arena_free(script_arena);
+	}
+
+	llist_iterate(files, free_script_file);
+	llist_free(files);
+	return success;
+}
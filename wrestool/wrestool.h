@@ -28,6 +28,10 @@
 #include <errno.h>		/* C89 */
 #include <getopt.h>		/* GNU Libc/Gnulib */
 #include "common/common.h"
+#include "common/hmap.h"
+#include "common/arena.h"
+#include "common/json.h"
+#include "win32.h"
 //#include "../common/win32.h"
 //#include "../common/fileread.h"
 //#include "../common/util.h"
@@ -39,30 +43,52 @@
 
 extern char *prgname;
 extern bool arg_raw;
+extern bool arg_convert;
+extern bool arg_quiet_non_pe;
+extern JsonWriter *json_output;
 
 /*
  * Structures 
  */
 
+typedef struct _WinResourceEntry WinResourceEntry;
+
 typedef struct _WinLibrary {
 	char *name;
-	FILE *file;
+	int fd;
 	char *memory;
 	uint8_t *first_resource;
+	Win32ImageSectionHeader *sections;
+	int section_count;
 	bool is_PE_binary;
-	int total_size;
+	bool is_mapped;
+	uint8_t *loaded_chunks;	/* chunks read so far, NULL if mapped */
+	size_t total_size;
+	WinResourceEntry *entries;
+	int entry_count;
+	HMap *index;
+	Arena *arena;
 } WinLibrary;
 
 typedef struct _WinResource {
-	char id[256];
+	char *id;		/* null-terminated, allocated in the library arena */
+	int id_len;
 	void *this;
 	void *children;
 	int level;
 	bool numeric_id;
 	bool is_directory;
+	int32_t value;		/* the id, if numeric_id */
 } WinResource;
 
-#define WINRES_ID_MAXLEN (256)
+/* A resource in the index, together with the directory entries leading
+ * to it. Holders below `level' are unused (id is the empty string). */
+struct _WinResourceEntry {
+	WinResource type;
+	WinResource name;
+	WinResource lang;
+	int level;
+};
 
 /*
  * Definitions
@@ -82,7 +108,24 @@ typedef struct _WinResource {
 
 #define STRIP_RES_ID_FORMAT(x) (x != NULL && (x[0] == '-' || x[0] == '+') ? ++x : x)
 
-typedef void (*DoResourceCallback) (WinLibrary *, WinResource *, WinResource *, WinResource *, WinResource *);
+/* A part of an extracted resource. */
+typedef struct {
+	const void *data;
+	size_t size;
+} ResourcePart;
+
+/* An extracted resource, made of parts that are written one after
+ * another. Headers made for the file format are allocated in header,
+ * the other parts refer to the library, so that the data need not be
+ * copied. */
+typedef struct {
+	ResourcePart *parts;
+	int count;
+	size_t size;		/* total size of the parts */
+	void *header;		/* allocated header, or NULL */
+} ExtractedResource;
+
+typedef bool (*DoResourceCallback) (WinLibrary *, WinResource *, WinResource *, WinResource *, WinResource *);
 
 /*
  * Function Prototypes
@@ -91,18 +134,34 @@ typedef void (*DoResourceCallback) (WinLibrary *, WinResource *, WinResource *,
 /* resource.c */
 /* WinResource *list_resources (WinLibrary *, WinResource *, int *); */
 bool read_library (WinLibrary *);
-WinResource *find_resource (WinLibrary *, char *, char *, char *, int *);
-void *get_resource_entry (WinLibrary *, WinResource *, int *);
-void do_resources (WinLibrary *, char *, char *, char *, DoResourceCallback);
-void print_resources_callback (WinLibrary *, WinResource *, WinResource *, WinResource *, WinResource *);
-/* bool compare_resource_id (WinResource *, char *); */
+void free_library_index (WinLibrary *);
+WinResource *find_resource (WinLibrary *, int32_t, int32_t, WinResource *);
+void *get_resource_entry (WinLibrary *, WinResource *, size_t *);
+int do_resources (WinLibrary *, char *, char *, char *, DoResourceCallback);
+bool print_resources_callback (WinLibrary *, WinResource *, WinResource *, WinResource *, WinResource *);
+
+/* fileread.c */
+bool sniff_library (WinLibrary *);
+bool map_library (WinLibrary *);
+void prefetch_library (WinLibrary *, size_t, size_t);
+void unmap_library (WinLibrary *);
 
 /* main.c */
 char *res_type_id_to_string (int);
+char *res_type_string_to_id (char *);
+int open_library (WinLibrary *, char *, Arena *);
+void close_library (WinLibrary *);
 char *get_destination_name (WinLibrary *, char *, char *, char *);
 
 /* extract.c */
-void *extract_resource (WinLibrary *, WinResource *, int *, bool *, char *, char *, bool);
-void extract_resources_callback (WinLibrary *, WinResource *, WinResource *, WinResource *, WinResource *);
+bool extract_resource (WinLibrary *, WinResource *, WinResource *, WinResource *, bool, ExtractedResource *);
+void *extracted_resource_data (ExtractedResource *, bool *);
+bool write_extracted_resource (WinLibrary *, ExtractedResource *, FILE *);
+void free_extracted_resource (ExtractedResource *);
+bool is_group_icon_cursor_type (WinResource *);
+bool extract_resources_callback (WinLibrary *, WinResource *, WinResource *, WinResource *, WinResource *);
+
+/* script.c */
+bool run_script (char *, char *, int);
 
 #endif